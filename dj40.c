@@ -1,9 +1,24 @@
-// this example uses stb_image_write to generate a PNG output from a JPEG XL input.
+// this example converts JPEG XL inputs into PNG or other raw formats, optionally in batches.
+// it doubles as a benchmarking driver: `dj40 -j 8 -f none *.jxl` reports decoding throughput only.
 
 #define J40_CONFIRM_THAT_THIS_IS_EXPERIMENTAL_AND_POTENTIALLY_UNSAFE
 #define J40_IMPLEMENTATION
 #include "j40.h"
 #include "j40.h"
+#ifdef __cplusplus
+	#include "j40.hpp" // not used here, but ensures that the C++ wrapper compiles in dj40-cxx
+#endif
+
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <time.h>
+#endif
 
 #ifdef __GNUC__ // stb_image_write issues too many warnings
 	#pragma GCC diagnostic push
@@ -19,37 +34,373 @@
 	#pragma GCC diagnostic pop
 #endif
 
-int main(int argc, char **argv) {
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s input.jxl [output.png]\n", argv[0]);
+////////////////////////////////////////////////////////////////////////////////
+// platform helpers
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION mutex_t;
+	static void mutex_init(mutex_t *m) { InitializeCriticalSection(m); }
+	static void mutex_lock(mutex_t *m) { EnterCriticalSection(m); }
+	static void mutex_unlock(mutex_t *m) { LeaveCriticalSection(m); }
+	static void mutex_free(mutex_t *m) { DeleteCriticalSection(m); }
+
+	static double now(void) {
+		LARGE_INTEGER freq, counter;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&counter);
+		return (double) counter.QuadPart / (double) freq.QuadPart;
+	}
+#else
+	typedef pthread_mutex_t mutex_t;
+	static void mutex_init(mutex_t *m) { pthread_mutex_init(m, NULL); }
+	static void mutex_lock(mutex_t *m) { pthread_mutex_lock(m); }
+	static void mutex_unlock(mutex_t *m) { pthread_mutex_unlock(m); }
+	static void mutex_free(mutex_t *m) { pthread_mutex_destroy(m); }
+
+	static double now(void) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+	}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// output writers
+
+typedef enum { FMT_INVALID = -1, FMT_NONE, FMT_PNG, FMT_PPM, FMT_PAM, FMT_PFM, FMT_Y4M } format_t;
+
+static const char *FORMAT_NAMES[] = { "none", "png", "ppm", "pam", "pfm", "y4m" };
+#define NUM_FORMATS (int) (sizeof(FORMAT_NAMES) / sizeof(*FORMAT_NAMES))
+
+static format_t parse_format(const char *name) {
+	int i;
+	for (i = 0; i < NUM_FORMATS; ++i) {
+		if (strcmp(name, FORMAT_NAMES[i]) == 0) return (format_t) i;
+	}
+	return FMT_INVALID;
+}
+
+// returns a format for given file name (case-insensitively), or FMT_INVALID if the extension is unknown
+static format_t format_from_path(const char *path) {
+	const char *ext = strrchr(path, '.');
+	char lower[8];
+	size_t i;
+	format_t format;
+
+	if (!ext || strlen(ext + 1) >= sizeof(lower)) return FMT_INVALID;
+	for (i = 0; ext[i + 1]; ++i) lower[i] = (char) tolower((unsigned char) ext[i + 1]);
+	lower[i] = '\0';
+	format = parse_format(lower);
+	return format == FMT_NONE ? FMT_INVALID : format;
+}
+
+// PPM (RGB8, alpha is dropped)
+static int write_ppm(FILE *out, j40_pixels_u8x4 pixels, uint8_t *line) {
+	int32_t x, y;
+	fprintf(out, "P6\n%d %d\n255\n", pixels.width, pixels.height);
+	for (y = 0; y < pixels.height; ++y) {
+		const j40_u8x4 *row = j40_row_u8x4(pixels, y);
+		for (x = 0; x < pixels.width; ++x) memcpy(line + x * 3, row[x], 3);
+		fwrite(line, 3, (size_t) pixels.width, out);
+	}
+	return ferror(out) ? 1 : 0;
+}
+
+// PAM (RGBA8)
+static int write_pam(FILE *out, j40_pixels_u8x4 pixels) {
+	int32_t y;
+	fprintf(out,
+		"P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+		pixels.width, pixels.height);
+	for (y = 0; y < pixels.height; ++y) fwrite(j40_row_u8x4(pixels, y), 4, (size_t) pixels.width, out);
+	return ferror(out) ? 1 : 0;
+}
+
+// PFM (RGB32F, little endian, rows are stored from the bottom; values are not linearized)
+static int write_pfm(FILE *out, j40_pixels_u8x4 pixels, uint8_t *line) {
+	int32_t x, y, c;
+	fprintf(out, "PF\n%d %d\n-1.0\n", pixels.width, pixels.height);
+	for (y = pixels.height - 1; y >= 0; --y) {
+		const j40_u8x4 *row = j40_row_u8x4(pixels, y);
+		for (x = 0; x < pixels.width; ++x) {
+			for (c = 0; c < 3; ++c) {
+				float v = (float) row[x][c] / 255.0f;
+				uint32_t bits;
+				memcpy(&bits, &v, 4);
+				line[(x * 3 + c) * 4 + 0] = (uint8_t) bits;
+				line[(x * 3 + c) * 4 + 1] = (uint8_t) (bits >> 8);
+				line[(x * 3 + c) * 4 + 2] = (uint8_t) (bits >> 16);
+				line[(x * 3 + c) * 4 + 3] = (uint8_t) (bits >> 24);
+			}
+		}
+		fwrite(line, 12, (size_t) pixels.width, out);
+	}
+	return ferror(out) ? 1 : 0;
+}
+
+// Y4M (a single 4:4:4 frame, BT.601 limited range)
+static int write_y4m(FILE *out, j40_pixels_u8x4 pixels, uint8_t *line) {
+	int32_t x, y, c;
+	fprintf(out, "YUV4MPEG2 W%d H%d F1:1 Ip A1:1 C444 XCOLORRANGE=LIMITED\nFRAME\n", pixels.width, pixels.height);
+	for (c = 0; c < 3; ++c) {
+		for (y = 0; y < pixels.height; ++y) {
+			const j40_u8x4 *row = j40_row_u8x4(pixels, y);
+			for (x = 0; x < pixels.width; ++x) {
+				int32_t r = row[x][0], g = row[x][1], b = row[x][2], v;
+				// offsets include the rounding and are chosen to keep the sum non-negative
+				switch (c) {
+				case 0: v = 66 * r + 129 * g + 25 * b + 4224; break;
+				case 1: v = -38 * r - 74 * g + 112 * b + 32896; break;
+				default: v = 112 * r - 94 * g - 18 * b + 32896; break;
+				}
+				line[x] = (uint8_t) (v >> 8);
+			}
+			fwrite(line, 1, (size_t) pixels.width, out);
+		}
+	}
+	return ferror(out) ? 1 : 0;
+}
+
+static int write_output(const char *path, format_t format, j40_pixels_u8x4 pixels) {
+	FILE *out;
+	uint8_t *line;
+	int ret;
+
+	if (format == FMT_PNG) {
+		return stbi_write_png(path, pixels.width, pixels.height, 4, pixels.data, pixels.stride_bytes) ? 0 : 1;
+	}
+
+	out = fopen(path, "wb");
+	if (!out) return 1;
+	line = (uint8_t*) malloc((size_t) pixels.width * 12); // enough for every format
+	if (!line) {
+		fclose(out);
 		return 1;
 	}
+	switch (format) {
+	case FMT_PPM: ret = write_ppm(out, pixels, line); break;
+	case FMT_PAM: ret = write_pam(out, pixels); break;
+	case FMT_PFM: ret = write_pfm(out, pixels, line); break;
+	case FMT_Y4M: ret = write_y4m(out, pixels, line); break;
+	default: ret = 1; break;
+	}
+	free(line);
+	if (fclose(out) != 0) ret = 1;
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// batch processing
+
+typedef struct {
+	// read-only after initialization
+	char **inputs;
+	int ninputs;
+	const char *output; // either an output path (single mode) or a directory (batch mode) or NULL
+	int batch;
+	format_t format;
+	int quiet;
+
+	// protected by `mutex`
+	mutex_t mutex;
+	int next;
+	int nfailed;
+	double total_pixels;
+	double total_decode_secs;
+} job_t;
 
+// returns a malloc'ed output path for given input in batch mode, e.g. `dir/foo.jxl` -> `outdir/foo.png`
+static char *batch_output_path(const job_t *job, const char *input) {
+	const char *base = input, *stem, *ext, *p;
+	size_t dirlen = job->output ? strlen(job->output) + 1 : 0, stemlen;
+	char *path;
+
+	for (p = input; *p; ++p) if (*p == '/' || *p == '\\') base = p + 1;
+	stem = job->output ? base : input; // the input directory is kept if there is no output directory
+	ext = strrchr(base, '.');
+	stemlen = ext && ext != base ? (size_t) (ext - stem) : strlen(stem);
+
+	path = (char*) malloc(dirlen + stemlen + 5);
+	if (!path) return NULL;
+	if (job->output) {
+		memcpy(path, job->output, dirlen - 1);
+		path[dirlen - 1] = '/';
+	}
+	memcpy(path + dirlen, stem, stemlen);
+	path[dirlen + stemlen] = '.';
+	memcpy(path + dirlen + stemlen + 1, FORMAT_NAMES[job->format], 4); // including the terminating NUL
+	return path;
+}
+
+static void process_one(job_t *job, const char *input) {
 	j40_image image;
-	j40_from_file(&image, argv[1]);
-	j40_output_format(&image, J40_RGBA, J40_U8X4);
+	j40_pixels_u8x4 pixels;
+	double start, decoded, written;
+	const char *error = NULL;
+	char *path = NULL;
 
+	memset(&pixels, 0, sizeof(pixels));
+
+	start = now();
+	j40_from_file(&image, input);
+	j40_output_format(&image, J40_RGBA, J40_U8X4);
 	if (j40_next_frame(&image)) {
 		j40_frame frame = j40_current_frame(&image);
-		j40_pixels_u8x4 pixels = j40_frame_pixels_u8x4(&frame, J40_RGBA);
-		if (argc > 2) {
-			fprintf(stderr, "%dx%d frame read.\n", pixels.width, pixels.height);
-			stbi_write_png(argv[2], pixels.width, pixels.height, 4, pixels.data, pixels.stride_bytes);
-		} else {
-			fprintf(stderr, "%dx%d frame read and discarded.\n", pixels.width, pixels.height);
-		}
+		pixels = j40_frame_pixels_u8x4(&frame, J40_RGBA);
 	}
+	if (j40_error(&image)) error = j40_error_string(&image);
+	decoded = now();
 
-	if (j40_error(&image)) {
-		fprintf(stderr, "Error: %s\n", j40_error_string(&image));
-		j40_free(&image);
-		return 1;
+	if (!error && job->format != FMT_NONE) {
+		path = job->batch ? batch_output_path(job, input) : (char*) job->output;
+		if (!path || write_output(path, job->format, pixels)) error = "Cannot write an output file";
 	}
+	written = now();
 
+	mutex_lock(&job->mutex);
+	if (error) {
+		++job->nfailed;
+		fprintf(stderr, "%s: Error: %s\n", input, error);
+	} else {
+		job->total_pixels += (double) pixels.width * (double) pixels.height;
+		job->total_decode_secs += decoded - start;
+		if (!job->quiet) {
+			fprintf(stderr, "%s: %dx%d, decoded in %.3f ms (%.2f MP/s)",
+				input, pixels.width, pixels.height, (decoded - start) * 1e3,
+				decoded > start ? (double) pixels.width * (double) pixels.height / 1e6 / (decoded - start) : 0.0);
+			if (job->format != FMT_NONE) fprintf(stderr, ", written in %.3f ms", (written - decoded) * 1e3);
+			fprintf(stderr, "\n");
+		}
+	}
+	mutex_unlock(&job->mutex);
+
+	if (job->batch) free(path);
 	j40_free(&image);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker(LPVOID data)
+#else
+static void *worker(void *data)
+#endif
+{
+	job_t *job = (job_t*) data;
+	for (;;) {
+		int i;
+		mutex_lock(&job->mutex);
+		i = job->next < job->ninputs ? job->next++ : -1;
+		mutex_unlock(&job->mutex);
+		if (i < 0) break;
+		process_one(job, job->inputs[i]);
+	}
 	return 0;
 }
 
+// runs `nthreads - 1` additional threads along with the current thread
+static void run_workers(job_t *job, int nthreads) {
+	int i, nspawned = 0;
+#ifdef _WIN32
+	HANDLE *threads = (HANDLE*) calloc((size_t) nthreads, sizeof(HANDLE));
+	for (i = 1; threads && i < nthreads; ++i) {
+		threads[nspawned] = CreateThread(NULL, 0, worker, job, 0, NULL);
+		if (threads[nspawned]) ++nspawned;
+	}
+	worker(job);
+	for (i = 0; i < nspawned; ++i) {
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+#else
+	pthread_t *threads = (pthread_t*) calloc((size_t) nthreads, sizeof(pthread_t));
+	for (i = 1; threads && i < nthreads; ++i) {
+		if (pthread_create(&threads[nspawned], NULL, worker, job) == 0) ++nspawned;
+	}
+	worker(job);
+	for (i = 0; i < nspawned; ++i) pthread_join(threads[i], NULL);
+#endif
+	free(threads);
+}
+
+static int usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [-q] input.jxl [output.{png,ppm,pam,pfm,y4m}]\n"
+		"       %s [options] input.jxl input.jxl... (batch mode, also implied by -j, -f or -o\n"
+		"             or when the second file has no known output extension)\n"
+		"Options:\n"
+		"  -j N       Decode N files in parallel (default: 1)\n"
+		"  -f FORMAT  Output format for batch mode: png, ppm, pam, pfm, y4m or none\n"
+		"             (default: png with -o, none otherwise)\n"
+		"  -o DIR     Write batch outputs into DIR instead of next to inputs\n"
+		"  -q         Only print errors and the final summary\n",
+		argv0, argv0);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	job_t job;
+	int nthreads = 1, argi, single;
+	double start, elapsed;
+
+	memset(&job, 0, sizeof(job));
+	job.format = FMT_INVALID; // to be determined
+
+	for (argi = 1; argi < argc && argv[argi][0] == '-' && argv[argi][1]; ++argi) {
+		const char *opt = argv[argi];
+		if (strcmp(opt, "--") == 0) {
+			++argi;
+			break;
+		} else if (strcmp(opt, "-q") == 0) {
+			job.quiet = 1;
+		} else if (argi + 1 < argc && strcmp(opt, "-j") == 0) {
+			nthreads = atoi(argv[++argi]);
+			if (nthreads < 1) return usage(argv[0]);
+			job.batch = 1;
+		} else if (argi + 1 < argc && strcmp(opt, "-f") == 0) {
+			job.format = parse_format(argv[++argi]);
+			if (job.format == FMT_INVALID) return usage(argv[0]);
+			job.batch = 1;
+		} else if (argi + 1 < argc && strcmp(opt, "-o") == 0) {
+			job.output = argv[++argi];
+			job.batch = 1;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if (argi >= argc) return usage(argv[0]);
+
+	job.inputs = argv + argi;
+	job.ninputs = argc - argi;
+	single = !job.batch && job.ninputs == 1; // the traditional single-file form, also below
+	if (!job.batch && job.ninputs == 2 && format_from_path(argv[argi + 1]) != FMT_INVALID) {
+		// the traditional `dj40 input.jxl output.png` form; `dj40 a.jxl b.jxl` is a batch instead
+		job.output = argv[argi + 1];
+		job.format = format_from_path(job.output);
+		job.ninputs = 1;
+		single = 1;
+	} else {
+		job.batch = 1;
+		if (job.format == FMT_INVALID) job.format = job.output ? FMT_PNG : FMT_NONE;
+	}
+	if (nthreads > job.ninputs) nthreads = job.ninputs;
+
+	mutex_init(&job.mutex);
+	start = now();
+	run_workers(&job, nthreads);
+	elapsed = now() - start;
+	mutex_free(&job.mutex);
+
+	if (!single && (job.ninputs > 1 || !job.quiet)) {
+		fprintf(stderr, "%d file(s), %d failed, %.3f s with %d thread(s): %.2f files/s, %.2f MP/s",
+			job.ninputs, job.nfailed, elapsed, nthreads,
+			elapsed > 0 ? (double) job.ninputs / elapsed : 0.0, elapsed > 0 ? job.total_pixels / 1e6 / elapsed : 0.0);
+		if (job.total_decode_secs > 0) {
+			fprintf(stderr, " (%.2f MP/s per thread in decoding)", job.total_pixels / 1e6 / job.total_decode_secs);
+		}
+		fprintf(stderr, "\n");
+	}
+	return job.nfailed ? 1 : 0;
+}
+
 // LeakSanitizer is on by default when AddressSanitizer is on, but this essentially
 // breaks gdb workflow. thus we disable LeakSanitizer unless specifically requested.
 #ifdef J40_DEBUG
@@ -62,4 +413,3 @@ int main(int argc, char **argv) {
 		const char *__asan_default_options() { return "detect_leaks=0"; }
 	#endif
 #endif
-
@@ -98,6 +98,15 @@ int main(int argc, char **argv) {
 	#include <limits.h>
 	#include <errno.h>
 	#include <stdio.h>
+	#if _POSIX_C_SOURCE >= 200112L
+		#include <fcntl.h> // posix_fadvise
+	#endif
+	#if defined J40_HUGE_PAGES && defined __linux__
+		#include <sys/mman.h> // mmap, madvise
+		#ifdef MADV_HUGEPAGE
+			#define J40__USE_HUGE_PAGES 1
+		#endif
+	#endif
 	#ifdef J40_DEBUG
 		#include <assert.h>
 	#endif
@@ -269,6 +278,131 @@ J40__DEFINE_PIXELS(j40_u8x4, u8x4);     // j40_pixels_u8x4, j40_frame_pixels_u8x
 //J40__DEFINE_PIXELS(j40_u32x4, u32x4); // j40_pixels_u32x4, j40_frame_pixels_u32x4, j40_row_u32x4
 //J40__DEFINE_PIXELS(j40_f32x4, f32x4); // j40_pixels_f32x4, j40_frame_pixels_f32x4, j40_row_f32x4
 
+// streaming output: if set before the first j40_next_frame call, each frame is delivered to `func`
+// as horizontal bands of rows as soon as they are available, instead of being kept as a whole.
+// `pixels` is only valid during the call, and `y` is the frame row where `pixels` start.
+// a nonzero return value (which should be less than J40_MIN_RESERVED_ERR) aborts the decoding.
+// since the whole frame is never kept, level 10 image size limits apply in this mode and
+// j40_frame_pixels_u8x4 will return an empty `j40_pixels_u8x4` instead.
+typedef j40_err (*j40_rows_u8x4_func)(j40_pixels_u8x4 pixels, int32_t y, void *data);
+J40_API j40_err j40_output_rows_u8x4(j40_image *image, int32_t channel, j40_rows_u8x4_func func, void *data);
+
+// incremental decoding: each j40_next_event call decodes until the next event and returns it,
+// or returns 0 if there are no more events or an error has occurred (check j40_error then).
+// this can be freely mixed with j40_next_frame, which simply continues until the frame is complete.
+#define J40_EVENT_HEADER        1 // the image header (and ICC profile if any) has been read
+#define J40_EVENT_LF            2 // all LF groups of the current frame have been decoded
+#define J40_EVENT_ROWS          3 // a single band of rows has been just delivered to j40_output_rows_u8x4
+#define J40_EVENT_FRAME         4 // the current frame is complete
+J40_API int j40_next_event(j40_image *image);
+
+// mip pyramid output: if requested before decoding, `nlevels - 1` downscaled copies of the frame
+// (1:2, 1:4 and 1:8, in this order) are produced along with the frame, from a single decoding.
+// level 0 is the frame itself, so j40_frame_level_u8x4(frame, channel, 0) is same to
+// j40_frame_pixels_u8x4(frame, channel). levels are available even in the streaming output,
+// where they are completed only after the entire frame has been delivered. the 1:8 level of
+// VarDCT frames comes directly from the LF image (unless there is an alpha channel).
+#define J40_MAX_LEVELS 4
+J40_API j40_err j40_output_levels(j40_image *image, int32_t nlevels);
+J40_API j40_pixels_u8x4 j40_frame_level_u8x4(const j40_frame *frame, int32_t channel, int32_t level);
+
+// resized output: if requested before decoding, frames are resized to exactly `width` x `height`
+// while being rendered, and j40_frame_pixels_u8x4 and j40_output_rows_u8x4 will see that size.
+// the decoder picks the cheapest source that has enough resolution for given size: the LF image
+// (1:8, VarDCT only), a limited number of progressive passes, or the full frame.
+// this can't be combined with j40_output_levels.
+#define J40_FILTER_AREA         1 // averages all covered pixels (box filter), best for large ratios
+#define J40_FILTER_LANCZOS3     2 // separable Lanczos filter with 3 lobes, sharper
+J40_API j40_err j40_output_size(j40_image *image, int32_t width, int32_t height, int32_t filter);
+
+// region output: if requested before decoding, only given rectangle of the frame is rendered and
+// j40_frame_pixels_u8x4 will return that rectangle. for VarDCT frames, LF groups and pass groups not
+// intersecting with the region are not decoded at all. this can't be combined with other output options.
+J40_API j40_err j40_output_region(j40_image *image, int32_t x, int32_t y, int32_t width, int32_t height);
+
+// speed/quality trade-offs, should be set before decoding and can be combined with other output options.
+// J40_APPROX_TRANSFER uses an interpolated table for the sRGB transfer function, which is off by
+// less than 0.01 levels in 8-bit outputs and about 1 level in 16-bit outputs. J40_FIXED_POINT turns
+// linear samples of 8-bit images into output levels through a 14-bit fixed-point index to an integer
+// table, skipping the transfer function entirely; this is off by at most 1 level against the default.
+// images with more bits are not affected.
+#define J40_APPROX_TRANSFER     1
+#define J40_FIXED_POINT         2
+J40_API j40_err j40_output_quality(j40_image *image, int32_t flags);
+
+// shared frame state: j40_shared_from_memory parses everything up to HfGlobal (headers, TOC, LfGlobal
+// and HfGlobal) of the first frame once, and any number of j40_image can be then attached to it by
+// j40_from_shared, possibly from multiple threads. attached images only decode their own LF and
+// pass groups, typically combined with j40_output_region. the shared state is immutable and
+// reference-counted; `buf` is freed with `freefunc` (if any) once j40_free_shared has been called
+// and all attached images have been freed. the reference count is only thread-safe with MSVC,
+// GCC/Clang or C11 atomics; otherwise attaching and freeing should be serialized. currently only VarDCT frames without extra channels and
+// with multiple sections can be shared.
+typedef struct j40_shared j40_shared;
+J40_API j40_err j40_shared_from_memory(
+	j40_shared **shared, void *buf, size_t size, j40_memory_free_func freefunc
+);
+J40_API j40_err j40_from_shared(j40_image *image, j40_shared *shared);
+J40_API void j40_free_shared(j40_shared *shared);
+
+// decoded tile cache: keeps groups (typically 256x256) rendered for region output in memory up to
+// `budget` bytes, evicting least recently used ones when full. once attached by j40_use_tile_cache
+// before decoding, region decodes copy cached groups of the same `image_id` instead of decoding them
+// again, so only newly exposed groups are decoded while panning. `image_id` is chosen by the caller
+// and should be distinct for each image content. tiles are also keyed by the number of decoded
+// passes and the output format. currently VarDCT frames only. the cache is not thread-safe (use one
+// cache per thread or serialize region decodes) and should outlive all images using it.
+typedef struct j40_tile_cache j40_tile_cache;
+typedef struct { uint64_t hits, misses, evictions; size_t bytes; } j40_tile_cache_stats;
+J40_API j40_tile_cache *j40_new_tile_cache(size_t budget); // NULL if out of memory
+J40_API void j40_free_tile_cache(j40_tile_cache *cache);
+J40_API j40_tile_cache_stats j40_tile_cache_get_stats(const j40_tile_cache *cache);
+J40_API j40_err j40_use_tile_cache(j40_image *image, j40_tile_cache *cache, uint64_t image_id);
+
+// TOC index: j40_save_toc_index serializes everything needed to locate each section of the current frame
+// (the container box map and the decoded TOC) into a versioned and checksummed blob, which can be stored
+// as a sidecar file. it can be called once the TOC has been read, e.g. after J40_EVENT_LF or j40_next_frame.
+// j40_load_toc_index, when called before decoding the same image, makes the decoder use that blob instead
+// of scanning container boxes and entropy-decoding the TOC. this is all it saves: the image header,
+// the frame header, LfGlobal and HfGlobal are still parsed as usual, and the TOC bytes are still read
+// to check their CRC, so a blob for another image (or for a modified or truncated file) fails with
+// `Uidx` when the decoder reaches the TOC.
+// `data` is copied and can be discarded after the call. the blob should be freed with j40_free_toc_index.
+J40_API j40_err j40_save_toc_index(j40_image *image, void **data, size_t *size);
+J40_API void j40_free_toc_index(void *data);
+J40_API j40_err j40_load_toc_index(j40_image *image, const void *data, size_t size);
+
+// batch decoding: decodes each of `n` in-memory images directly into caller-provided buffers,
+// reusing internal allocations across images. this is much cheaper than separate j40_image
+// instances for many small images. it never fails as a whole; each `outputs[i].err` should be
+// checked instead, and the number of successfully decoded images is returned.
+// images are subject to the usual limits, not the relaxed ones of j40_output_rows_u8x4.
+// different threads can call this function at the same time for disjoint sets of images.
+typedef struct {
+	const void *data; // JPEG XL file contents, only used during the call
+	size_t size;
+} j40_batch_input;
+
+typedef struct {
+	// set by the caller: rows are written to `data` for at most `capacity` bytes.
+	// `stride_bytes` is the number of bytes between each row, or 0 for `width * 4`.
+	void *data;
+	size_t capacity;
+	int32_t stride_bytes; // 0 is replaced with the actual stride after decoding
+	// set by j40_decode_batch; only the first frame is decoded
+	int32_t width, height;
+	j40_err err;
+} j40_batch_output;
+
+typedef struct {
+	int32_t channel, format; // same as in j40_output_format; currently J40_RGBA and J40_U8X4 only
+} j40_batch_options;
+
+// `options` can be NULL for defaults
+J40_API int32_t j40_decode_batch(
+	const j40_batch_input *inputs, j40_batch_output *outputs, int32_t n, const j40_batch_options *options
+);
+
 J40_API void j40_free(j40_image *image);
 
 #endif // J40__RECURSING <= 0
@@ -458,6 +592,7 @@ typedef struct {
 	struct j40__image_st *image;
 	struct j40__frame_st *frame;
 	struct j40__lf_group_st *lf_group;
+	struct j40__pool_st *pool; // can be NULL, then released planes are simply freed
 	const struct j40__limits *limits;
 } j40__st;
 
@@ -1045,6 +1180,38 @@ J40_STATIC uint8_t j40__plane_all_equal_typed(const j40__plane *begin, const j40
 J40_STATIC uint8_t j40__plane_all_equal_typed_or_empty(const j40__plane *begin, const j40__plane *end);
 J40_STATIC void j40__free_plane(j40__plane *plane);
 
+// when J40_HUGE_PAGES is defined (Linux only), pixels of planes larger than J40_HUGE_PAGE_THRESHOLD
+// are allocated with 2 MiB-aligned anonymous mappings backed by transparent huge pages,
+// which greatly reduces TLB misses for row-strided accesses to very large frames.
+// such pixels are marked with misalign = J40__MISALIGN_MAPPED, which is never a valid misalign.
+#ifndef J40_HUGE_PAGE_THRESHOLD
+	#define J40_HUGE_PAGE_THRESHOLD ((size_t) 64 << 20)
+#endif
+#define J40__HUGE_PAGE_SIZE ((size_t) 2 << 20)
+#define J40__MISALIGN_MAPPED 0xff
+
+// *fresh is set to 1 if the returned pixels are known to be zero-filled and not yet touched
+J40_STATIC void *j40__alloc_pixels(size_t total, size_t *misalign, int *fresh);
+J40_STATIC void j40__free_pixels(void *pixels, size_t total, size_t misalign);
+
+// a per-decoder pool of pixel buffers, so that short-lived planes of the same size class
+// (e.g. per-section modular channels) don't have to be repeatedly allocated and freed.
+// the size class is the pair of stride_bytes and height; the actual plane type doesn't matter
+// as long as the byte layout is identical. entries are evicted in the order of release.
+#define J40__POOL_SIZE 16
+#define J40__POOL_MAX_BYTES ((int64_t) 64 << 20)
+
+typedef struct j40__pool_st {
+	struct { int32_t stride_bytes, height; uint8_t misalign; uintptr_t pixels; } entries[J40__POOL_SIZE];
+	int32_t nentries; // entries[0] is the least recently released one
+	int64_t nbytes; // total bytes held by entries, <= J40__POOL_MAX_BYTES
+} j40__pool_st;
+
+J40_STATIC void *j40__take_from_pool(j40__pool_st *pool, int32_t stride_bytes, int32_t height, size_t *misalign);
+// same to j40__free_plane if `pool` is NULL or the plane can't be recycled
+J40_STATIC void j40__release_plane(j40__pool_st *pool, j40__plane *plane);
+J40_STATIC void j40__free_pool(j40__pool_st *pool);
+
 #ifdef J40_IMPLEMENTATION
 
 J40__STATIC_RETURNS_ERR j40__init_plane(
@@ -1054,6 +1221,7 @@ J40__STATIC_RETURNS_ERR j40__init_plane(
 	void *pixels;
 	int32_t stride_bytes;
 	size_t total, misalign;
+	int fresh = 0;
 
 	out->type = 0;
 	J40__ASSERT(width > 0 && height > 0);
@@ -1065,7 +1233,8 @@ J40__STATIC_RETURNS_ERR j40__init_plane(
 		"bigg");
 	J40__SHOULD((size_t) stride_bytes <= SIZE_MAX / (uint32_t) height, "bigg");
 	total = (size_t) stride_bytes * (size_t) height;
-	J40__SHOULD(pixels = j40__alloc_aligned(total, J40__PIXELS_ALIGN, &misalign), "!mem");
+	pixels = st->pool ? j40__take_from_pool(st->pool, stride_bytes, height, &misalign) : NULL;
+	if (!pixels) J40__SHOULD(pixels = j40__alloc_pixels(total, &misalign, &fresh), "!mem");
 
 	out->stride_bytes = stride_bytes;
 	out->width = width;
@@ -1074,12 +1243,49 @@ J40__STATIC_RETURNS_ERR j40__init_plane(
 	out->vshift = out->hshift = 0;
 	out->misalign = (uint8_t) misalign;
 	out->pixels = (uintptr_t) pixels;
-	if (flags & J40__PLANE_CLEAR) memset(pixels, 0, total);
+	// do not touch fresh mappings, so that pages get committed only when first written
+	if ((flags & J40__PLANE_CLEAR) && !fresh) memset(pixels, 0, total);
 
 J40__ON_ERROR:
 	return st->err;
 }
 
+J40_STATIC void *j40__alloc_pixels(size_t total, size_t *misalign, int *fresh) {
+	*fresh = 0;
+#ifdef J40__USE_HUGE_PAGES
+	if (total >= J40_HUGE_PAGE_THRESHOLD && total <= SIZE_MAX - 2 * J40__HUGE_PAGE_SIZE) {
+		size_t len = (total + J40__HUGE_PAGE_SIZE - 1) / J40__HUGE_PAGE_SIZE * J40__HUGE_PAGE_SIZE, head;
+		// over-allocate by a single huge page and trim both ends to get the alignment
+		char *p = (char*) mmap(
+			NULL, len + J40__HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != (char*) MAP_FAILED) {
+			head = (J40__HUGE_PAGE_SIZE - (uintptr_t) p % J40__HUGE_PAGE_SIZE) % J40__HUGE_PAGE_SIZE;
+			if (head) munmap(p, head);
+			munmap(p + head + len, J40__HUGE_PAGE_SIZE - head);
+			p += head;
+			(void) madvise(p, len, MADV_HUGEPAGE); // purely advisory
+			*misalign = J40__MISALIGN_MAPPED;
+			*fresh = 1;
+			return p;
+		}
+		// otherwise fall back to the ordinary allocation
+	}
+#endif
+	return j40__alloc_aligned(total, J40__PIXELS_ALIGN, misalign);
+}
+
+J40_STATIC void j40__free_pixels(void *pixels, size_t total, size_t misalign) {
+#ifdef J40__USE_HUGE_PAGES
+	if (misalign == J40__MISALIGN_MAPPED) {
+		munmap(pixels, (total + J40__HUGE_PAGE_SIZE - 1) / J40__HUGE_PAGE_SIZE * J40__HUGE_PAGE_SIZE);
+		return;
+	}
+#else
+	(void) total;
+#endif
+	j40__free_aligned(pixels, J40__PIXELS_ALIGN, misalign);
+}
+
 // an empty plane can arise from inverse modular transform, but it can be a bug as well,
 // hence a separate function and separate type.
 J40_STATIC void j40__init_empty_plane(j40__plane *out) {
@@ -1133,7 +1339,7 @@ J40_STATIC void j40__free_plane(j40__plane *plane) {
 	// we don't touch pixels if plane is zero-initialized via memset, because while `plane->type` is
 	// definitely zero in this case `(void*) plane->pixels` might NOT be a null pointer!
 	if (plane->type && plane->type != J40__PLANE_EMPTY) {
-		j40__free_aligned((void*) plane->pixels, J40__PIXELS_ALIGN, plane->misalign);
+		j40__free_pixels((void*) plane->pixels, (size_t) plane->stride_bytes * (size_t) plane->height, plane->misalign);
 	}
 	plane->width = plane->height = plane->stride_bytes = 0;
 	plane->type = 0;
@@ -1142,6 +1348,66 @@ J40_STATIC void j40__free_plane(j40__plane *plane) {
 	plane->pixels = (uintptr_t) (void*) 0; 
 }
 
+J40_STATIC void *j40__take_from_pool(j40__pool_st *pool, int32_t stride_bytes, int32_t height, size_t *misalign) {
+	int32_t i;
+	// search from the most recently released one, which is more likely to be in the cache
+	for (i = pool->nentries - 1; i >= 0; --i) {
+		if (pool->entries[i].stride_bytes == stride_bytes && pool->entries[i].height == height) {
+			void *pixels = (void*) pool->entries[i].pixels;
+			*misalign = pool->entries[i].misalign;
+			pool->nbytes -= (int64_t) stride_bytes * height;
+			memmove(&pool->entries[i], &pool->entries[i + 1], sizeof(*pool->entries) * (size_t) (pool->nentries - i - 1));
+			--pool->nentries;
+			return pixels;
+		}
+	}
+	return NULL;
+}
+
+J40_STATIC void j40__release_plane(j40__pool_st *pool, j40__plane *plane) {
+	int64_t nbytes;
+
+	if (!pool || !plane->type || plane->type == J40__PLANE_EMPTY) {
+		j40__free_plane(plane);
+		return;
+	}
+
+	nbytes = (int64_t) plane->stride_bytes * plane->height;
+	if (nbytes > J40__POOL_MAX_BYTES) {
+		j40__free_plane(plane);
+		return;
+	}
+
+	// evict least recently released entries until the new entry fits
+	while (pool->nentries == J40__POOL_SIZE || pool->nbytes + nbytes > J40__POOL_MAX_BYTES) {
+		J40__ASSERT(pool->nentries > 0);
+		j40__free_pixels((void*) pool->entries[0].pixels,
+			(size_t) pool->entries[0].stride_bytes * (size_t) pool->entries[0].height, pool->entries[0].misalign);
+		pool->nbytes -= (int64_t) pool->entries[0].stride_bytes * pool->entries[0].height;
+		memmove(&pool->entries[0], &pool->entries[1], sizeof(*pool->entries) * (size_t) --pool->nentries);
+	}
+
+	pool->entries[pool->nentries].stride_bytes = plane->stride_bytes;
+	pool->entries[pool->nentries].height = plane->height;
+	pool->entries[pool->nentries].misalign = plane->misalign;
+	pool->entries[pool->nentries].pixels = plane->pixels;
+	++pool->nentries;
+	pool->nbytes += nbytes;
+
+	plane->type = 0; // so that the following doesn't free pixels
+	j40__free_plane(plane);
+}
+
+J40_STATIC void j40__free_pool(j40__pool_st *pool) {
+	int32_t i;
+	for (i = 0; i < pool->nentries; ++i) {
+		j40__free_pixels((void*) pool->entries[i].pixels,
+			(size_t) pool->entries[i].stride_bytes * (size_t) pool->entries[i].height, pool->entries[i].misalign);
+	}
+	pool->nentries = 0;
+	pool->nbytes = 0;
+}
+
 #endif // defined J40_IMPLEMENTATION
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1174,18 +1440,25 @@ J40_STATIC const j40__limits J40__MAIN_LV5_LIMITS = {
 	/*.nb_channels_tr =*/ 256, /*.tree_depth =*/ 64, /*.zf_pixels =*/ 1 << 28,
 };
 
-#if 0
-J40_STATIC j40__limits J40__MAIN_LV10_LIMITS = {
+J40_STATIC const j40__limits J40__MAIN_LV10_LIMITS = {
 	/*.pixels =*/ (int64_t) 1 << 40, /*.width =*/ 1 << 30, /*.height =*/ 1 << 30,
 	/*.icc_output_size =*/ 1u << 28, /*.bpp =*/ 32, /*.ec_black_allowed =*/ 1,
 	/*.num_extra_channels =*/ 256, /*.needs_modular_16bit_buffers =*/ 0, /*.nb_transforms =*/ 512,
 	/*.nb_channels_tr =*/ 1 << 16, /*.tree_depth =*/ 2048, /*.zf_pixels =*/ 0,
 };
-#endif
+
+// Main level 5 except for image dimensions, used for the streaming output (see j40__init_state).
+// only VarDCT frames can actually be that large, see the end of j40__frame_header.
+J40_STATIC const j40__limits J40__MAIN_LV5_STREAMING_LIMITS = {
+	/*.pixels =*/ (int64_t) 1 << 40, /*.width =*/ 1 << 30, /*.height =*/ 1 << 30,
+	/*.icc_output_size =*/ 1u << 22, /*.bpp =*/ 16, /*.ec_black_allowed =*/ 0,
+	/*.num_extra_channels =*/ 4, /*.needs_modular_16bit_buffers =*/ 1, /*.nb_transforms =*/ 8,
+	/*.nb_channels_tr =*/ 256, /*.tree_depth =*/ 64, /*.zf_pixels =*/ 1 << 28,
+};
 
 #endif // defined J40_IMPLEMENTATION
 
-extern const j40__limits J40__MAIN_LV5_LIMITS/*, J40__MAIN_LV10_LIMITS*/;
+extern const j40__limits J40__MAIN_LV5_LIMITS, J40__MAIN_LV10_LIMITS, J40__MAIN_LV5_STREAMING_LIMITS;
 
 ////////////////////////////////////////////////////////////////////////////////
 // input source
@@ -1193,11 +1466,14 @@ extern const j40__limits J40__MAIN_LV5_LIMITS/*, J40__MAIN_LV10_LIMITS*/;
 typedef int (*j40_source_read_func)(uint8_t *buf, int64_t fileoff, size_t maxsize, size_t *size, void *data);
 typedef int (*j40_source_seek_func)(int64_t fileoff, void *data);
 typedef void (*j40_source_free_func)(void *data); // intentionally same to j40_memory_free_func
+// a hint that [fileoff, fileoff + size) will be soon read; should not block and can't fail
+typedef void (*j40_source_prefetch_func)(int64_t fileoff, int64_t size, void *data);
 
 typedef struct j40__source_st {
 	j40_source_read_func read_func;
 	j40_source_seek_func seek_func;
 	j40_source_free_func free_func;
+	j40_source_prefetch_func prefetch_func; // can be NULL
 	void *data;
 
 	int64_t fileoff; // absolute file offset, assumed to be 0 at the initialization
@@ -1213,6 +1489,8 @@ J40__STATIC_RETURNS_ERR j40__try_read_from_source(
 );
 J40__STATIC_RETURNS_ERR j40__read_from_source(j40__st *st, uint8_t *buf, int64_t size);
 J40__STATIC_RETURNS_ERR j40__seek_from_source(j40__st *st, int64_t fileoff);
+J40_STATIC void j40__prefetch_from_source(j40__st *st, int64_t fileoff, int64_t size);
+J40_STATIC const uint8_t *j40__borrow_from_source(j40__st *st, int64_t fileoff, int64_t size);
 J40_STATIC void j40__free_source(j40__source_st *source);
 
 #ifdef J40_IMPLEMENTATION
@@ -1231,6 +1509,7 @@ J40__STATIC_RETURNS_ERR j40__init_memory_source(
 	source->read_func = j40__memory_source_read;
 	source->seek_func = NULL;
 	source->free_func = freefunc;
+	source->prefetch_func = NULL; // everything is already in memory
 	source->data = buf;
 	source->fileoff = 0;
 	source->fileoff_limit = (int64_t) size;
@@ -1277,6 +1556,19 @@ J40_STATIC void j40__file_source_free(void *data) {
 	fclose(fp);
 }
 
+#if _POSIX_C_SOURCE >= 200112L
+	// lets the kernel start reading pages in background, which overlaps with the actual decoding.
+	// this never moves the file position, so it doesn't interfere with buffered reads from `fp`.
+	J40_STATIC void j40__file_source_prefetch(int64_t fileoff, int64_t size, void *data) {
+		FILE *fp = (FILE*) data;
+		if (fileoff > (int64_t) LONG_MAX || size > (int64_t) LONG_MAX) return; // off_t might be 32-bit
+		(void) posix_fadvise(fileno(fp), (off_t) fileoff, (off_t) size, POSIX_FADV_WILLNEED);
+	}
+	#define J40__FILE_SOURCE_PREFETCH j40__file_source_prefetch
+#else
+	#define J40__FILE_SOURCE_PREFETCH NULL
+#endif
+
 J40__STATIC_RETURNS_ERR j40__init_file_source(j40__st *st, const char *path, j40__source_st *source) {
 	FILE *fp;
 	int saved_errno;
@@ -1294,6 +1586,7 @@ J40__STATIC_RETURNS_ERR j40__init_file_source(j40__st *st, const char *path, j40
 	source->read_func = j40__file_source_read;
 	source->seek_func = j40__file_source_seek;
 	source->free_func = j40__file_source_free;
+	source->prefetch_func = J40__FILE_SOURCE_PREFETCH;
 	source->data = fp;
 	source->fileoff = 0;
 	source->fileoff_limit = ((uint64_t) INT64_MAX < SIZE_MAX ? INT64_MAX : (int64_t) SIZE_MAX);
@@ -1377,11 +1670,30 @@ J40__ON_ERROR:
 	return st->err;
 }
 
+J40_STATIC void j40__prefetch_from_source(j40__st *st, int64_t fileoff, int64_t size) {
+	j40__source_st *source = st->source;
+	if (!source->prefetch_func || size <= 0) return;
+	if (fileoff < 0 || fileoff >= source->fileoff_limit) return;
+	size = j40__min64(size, source->fileoff_limit - fileoff);
+	source->prefetch_func(fileoff, size, source->data);
+}
+
+// returns a pointer to [fileoff, fileoff + size) that remains valid until the source is freed,
+// or NULL if the source can't provide one (in which case the caller should read as usual).
+// currently only the memory source supports this, and only as long as the range is in bounds.
+J40_STATIC const uint8_t *j40__borrow_from_source(j40__st *st, int64_t fileoff, int64_t size) {
+	j40__source_st *source = st->source;
+	if (source->read_func != j40__memory_source_read) return NULL;
+	if (fileoff < 0 || size < 0 || fileoff > source->fileoff_limit - size) return NULL;
+	return (const uint8_t*) source->data + fileoff;
+}
+
 J40_STATIC void j40__free_source(j40__source_st *source) {
 	if (source->free_func) source->free_func(source->data);
 	source->read_func = NULL;
 	source->seek_func = NULL;
 	source->free_func = NULL;
+	source->prefetch_func = NULL;
 	source->data = NULL;
 }
 
@@ -1432,6 +1744,7 @@ J40__STATIC_RETURNS_ERR j40__box_header(j40__st *st, uint32_t *type, int64_t *si
 J40__STATIC_RETURNS_ERR j40__container(j40__st *st, int64_t wanted_codeoff);
 J40_STATIC int32_t j40__search_codestream_offset(const j40__st *st, int64_t codeoff);
 J40__STATIC_RETURNS_ERR j40__map_codestream_offset(j40__st *st, int64_t codeoff, int64_t *fileoff);
+J40_STATIC void j40__prefetch_codestream(j40__st *st, int64_t codeoff, int64_t size);
 J40_STATIC void j40__free_container(j40__container_st *container);
 
 #ifdef J40_IMPLEMENTATION
@@ -1641,6 +1954,36 @@ J40__ON_ERROR:
 	return st->err;
 }
 
+// issues prefetch hints for codestream offsets [codeoff, codeoff + size), possibly split into
+// multiple file ranges. this is a best effort: any portion not yet mapped is silently ignored,
+// because mapping more boxes requires actual reads which would defeat the purpose.
+J40_STATIC void j40__prefetch_codestream(j40__st *st, int64_t codeoff, int64_t size) {
+	j40__container_st *container = st->container;
+	j40__map *map = container->map;
+	int32_t nmap = container->nmap, i;
+
+	if (!st->source->prefetch_func || !map || nmap <= 0) return;
+
+	i = j40__search_codestream_offset(st, codeoff);
+	while (size > 0) {
+		int64_t fileoff, readable_size;
+		if (i < nmap - 1) {
+			readable_size = j40__min64(size, map[i+1].codeoff - codeoff);
+			fileoff = map[i].fileoff + (codeoff - map[i].codeoff); // can't overflow, see above
+		} else if (container->flags & J40__IMPLIED_LAST_MAP_ENTRY) {
+			readable_size = size;
+			if (!j40__add64(map[i].fileoff, codeoff - map[i].codeoff, &fileoff)) return;
+		} else {
+			return;
+		}
+		if (readable_size <= 0) return; // codeoff is before the first map entry
+		j40__prefetch_from_source(st, fileoff, readable_size);
+		codeoff += readable_size;
+		size -= readable_size;
+		++i;
+	}
+}
+
 J40_STATIC void j40__free_container(j40__container_st *container) {
 	j40__free(container->map);
 	container->map = NULL;
@@ -1660,12 +2003,18 @@ typedef struct j40__buffer_st {
 	int64_t codeoff_limit; // codestream offset can't exceed this; used for per-section decoding
 
 	j40__bits_st checkpoint; // the earliest point that the parser can ever backtrack
+
+	// if nonzero, `buf` is borrowed from the source (see j40__borrow_from_source) and should be
+	// neither altered nor freed. `buf` then always contains everything up to `codeoff_limit`.
+	int borrowed;
 } j40__buffer_st;
 
 J40__STATIC_RETURNS_ERR j40__init_buffer(j40__st *st, int64_t codeoff, int64_t codeoff_limit);
+J40__STATIC_RETURNS_ERR j40__init_section_buffer(j40__st *st, int64_t codeoff, int32_t size);
 J40__STATIC_RETURNS_ERR j40__refill_buffer(j40__st *st);
 J40__STATIC_RETURNS_ERR j40__seek_buffer(j40__st *st, int64_t codeoff);
 J40_STATIC int64_t j40__codestream_offset(const j40__st *st);
+J40_STATIC int64_t j40__bits_codeoff(const j40__st *st);
 J40_MAYBE_UNUSED J40_STATIC int64_t j40__bits_read(const j40__st *st);
 J40_STATIC void j40__free_buffer(j40__buffer_st *buffer);
 
@@ -1684,6 +2033,57 @@ J40__STATIC_RETURNS_ERR j40__init_buffer(j40__st *st, int64_t codeoff, int64_t c
 	buffer->capacity = J40__INITIAL_BUFSIZE;
 	buffer->next_codeoff = codeoff;
 	buffer->codeoff_limit = codeoff_limit;
+	buffer->borrowed = 0;
+	bits->bits = 0;
+	bits->nbits = 0;
+	*checkpoint = *bits;
+J40__ON_ERROR:
+	return st->err;
+}
+
+// unlike j40__init_buffer, the exact size is known in advance and no backtracking happens
+// before the end of section, so the buffer never has to grow and can be filled at once.
+// if the whole section is contiguous in the memory source, no allocation happens at all.
+J40__STATIC_RETURNS_ERR j40__init_section_buffer(j40__st *st, int64_t codeoff, int32_t size) {
+	j40__bits_st *bits = &st->bits, *checkpoint = &st->buffer->checkpoint;
+	j40__buffer_st *buffer = st->buffer;
+	j40__container_st *container = st->container;
+	const uint8_t *borrowed = NULL;
+	int64_t codeoff_limit;
+
+	J40__ASSERT(!buffer->buf);
+	J40__ASSERT(size >= 0);
+	J40__SHOULD(j40__add64(codeoff, size, &codeoff_limit), "flen");
+
+	if (container->map && container->nmap > 0) {
+		j40__map *map = container->map;
+		int32_t nmap = container->nmap, i = j40__search_codestream_offset(st, codeoff);
+		if (
+			map[i].codeoff <= codeoff &&
+			(i < nmap - 1 ? codeoff_limit <= map[i+1].codeoff : !!(container->flags & J40__IMPLIED_LAST_MAP_ENTRY))
+		) {
+			int64_t fileoff;
+			if (j40__add64(map[i].fileoff, codeoff - map[i].codeoff, &fileoff)) {
+				borrowed = j40__borrow_from_source(st, fileoff, size);
+			}
+		}
+	}
+
+	if (borrowed) {
+		buffer->buf = (uint8_t*) borrowed; // never written, see j40__refill_buffer
+		buffer->size = buffer->capacity = size;
+		buffer->next_codeoff = codeoff_limit;
+		buffer->borrowed = 1;
+	} else {
+		J40__TRY_MALLOC(uint8_t, &buffer->buf, (size_t) j40__max32(size, 1));
+		buffer->size = 0;
+		buffer->capacity = size;
+		buffer->next_codeoff = codeoff;
+		buffer->borrowed = 0;
+	}
+	buffer->codeoff_limit = codeoff_limit;
+	bits->ptr = buffer->buf;
+	bits->end = buffer->buf + buffer->size;
 	bits->bits = 0;
 	bits->nbits = 0;
 	*checkpoint = *bits;
@@ -1702,6 +2102,11 @@ J40__STATIC_RETURNS_ERR j40__refill_buffer(j40__st *st) {
 	J40__ASSERT(J40__INBOUNDS(checkpoint->ptr, buffer->buf, buffer->size));
 	J40__ASSERT(checkpoint->ptr <= bits->ptr);
 
+	// nothing more to read, so don't bother to trim or grow the buffer; this is always the case
+	// for borrowed buffers, which should never be altered
+	if (buffer->next_codeoff >= buffer->codeoff_limit) return 0;
+	J40__ASSERT(!buffer->borrowed);
+
 	// trim the committed portion from the backing buffer
 	if (checkpoint->ptr > buffer->buf) {
 		int64_t committed_size = (int64_t) (checkpoint->ptr - buffer->buf);
@@ -1781,6 +2186,7 @@ J40__STATIC_RETURNS_ERR j40__seek_buffer(j40__st *st, int64_t codeoff) {
 		st->bits.ptr = st->buffer->buf + (st->buffer->size - reusable_size);
 		st->bits.end = st->buffer->buf + st->buffer->size;
 	} else {
+		J40__ASSERT(!st->buffer->borrowed);
 		st->bits.ptr = st->bits.end = st->buffer->buf;
 		st->buffer->size = 0;
 		st->buffer->next_codeoff = codeoff;
@@ -1796,19 +2202,25 @@ J40_STATIC int64_t j40__codestream_offset(const j40__st *st) {
 	return st->buffer->next_codeoff - st->buffer->size + (st->bits.ptr - st->buffer->buf) - st->bits.nbits / 8;
 }
 
-// diagnostic only, doesn't check for overflow or anything
+// the codestream offset for the byte that contains the first bit to read
+J40_STATIC int64_t j40__bits_codeoff(const j40__st *st) {
+	int32_t nbytes = j40__ceil_div32(st->bits.nbits, 8);
+	return st->buffer->next_codeoff - st->buffer->size + (st->bits.ptr - st->buffer->buf) - nbytes;
+}
+
+// diagnostic and TOC index only, doesn't check for overflow or anything
 J40_MAYBE_UNUSED J40_STATIC int64_t j40__bits_read(const j40__st *st) {
-	int32_t nbytes = j40__ceil_div32(st->bits.nbits, 8), nbits = 8 * nbytes - st->bits.nbits;
-	// the codestream offset for the byte that contains the first bit to read
-	int64_t codeoff = st->buffer->next_codeoff - st->buffer->size + (st->bits.ptr - st->buffer->buf) - nbytes;
+	int32_t nbits = 8 * j40__ceil_div32(st->bits.nbits, 8) - st->bits.nbits;
+	int64_t codeoff = j40__bits_codeoff(st);
 	j40__map map = st->container->map[j40__search_codestream_offset(st, codeoff)];
 	return (map.fileoff + (codeoff - map.codeoff)) * 8 + nbits;
 }
 
 J40_STATIC void j40__free_buffer(j40__buffer_st *buffer) {
-	j40__free(buffer->buf);
+	if (!buffer->borrowed) j40__free(buffer->buf);
 	buffer->buf = NULL;
 	buffer->size = buffer->capacity = 0;
+	buffer->borrowed = 0;
 }
 
 #endif // defined J40_IMPLEMENTATION
@@ -3585,6 +3997,8 @@ J40__STATIC_RETURNS_ERR j40__modular_header(
 	j40__modular *m
 );
 J40__STATIC_RETURNS_ERR j40__allocate_modular(j40__st *st, j40__modular *m);
+// same to j40__free_modular, but channels are released to the pool (if any) for later reuse
+J40_STATIC void j40__release_modular(j40__pool_st *pool, j40__modular *m);
 J40_STATIC void j40__free_modular(j40__modular *m);
 
 #ifdef J40_IMPLEMENTATION
@@ -3874,7 +4288,7 @@ J40__ON_ERROR:
 	return st->err;
 }
 
-J40_STATIC void j40__free_modular(j40__modular *m) {
+J40_STATIC void j40__release_modular(j40__pool_st *pool, j40__modular *m) {
 	int32_t i;
 	j40__free_code(&m->code);
 	if (!m->use_global_tree) {
@@ -3882,7 +4296,7 @@ J40_STATIC void j40__free_modular(j40__modular *m) {
 		j40__free_code_spec(&m->codespec);
 	}
 	if (m->channel) {
-		for (i = 0; i < m->num_channels; ++i) j40__free_plane(&m->channel[i]);
+		for (i = 0; i < m->num_channels; ++i) j40__release_plane(pool, &m->channel[i]);
 		j40__free(m->channel);
 		m->channel = NULL;
 	}
@@ -3894,6 +4308,10 @@ J40_STATIC void j40__free_modular(j40__modular *m) {
 	m->num_channels = 0;
 }
 
+J40_STATIC void j40__free_modular(j40__modular *m) {
+	j40__release_modular(NULL, m);
+}
+
 #endif // defined J40_IMPLEMENTATION
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -5080,6 +5498,13 @@ typedef struct j40__frame_st {
 	j40__blend_info blend_info, *ec_blend_info;
 	int32_t save_as_ref;
 	int save_before_ct;
+	int keep_lf; // set by the API (see j40_output_levels) instead of the bitstream
+	int32_t max_passes; // passes to be actually decoded (see j40__plan_output), 0 for the LF image only
+	int32_t region_x0, region_y0, region_x1, region_y1; // set by j40_output_region, unused if region_x1 == 0
+	uint8_t *tile_cached; // [num_groups], nonzero if the group was fetched from the tile cache (or NULL)
+	int approx_transfer, fixed_point; // set by j40_output_quality
+	float *transfer_lut; // built by j40__prepare_transfer for approx_transfer, NULL otherwise
+	uint8_t *transfer_lut8; // built by j40__prepare_transfer for fixed_point, NULL otherwise
 	int32_t name_len;
 	char *name;
 	struct {
@@ -5134,6 +5559,9 @@ J40_STATIC void j40__free_frame_state(j40__frame_st *f) {
 	j40__free_code_spec(&f->global_codespec);
 	j40__free_modular(&f->gmodular);
 	j40__free(f->block_ctx_map);
+	j40__free(f->tile_cached);
+	j40__free(f->transfer_lut);
+	j40__free(f->transfer_lut8);
 	for (i = 0; i < J40__NUM_DCT_PARAMS; ++i) j40__free_dq_matrix(&f->dq_matrix[i]);
 	for (i = 0; i < J40__MAX_PASSES; ++i) {
 		for (j = 0; j < J40__NUM_ORDERS; ++j) {
@@ -5149,6 +5577,9 @@ J40_STATIC void j40__free_frame_state(j40__frame_st *f) {
 	f->name = NULL;
 	f->global_tree = NULL;
 	f->block_ctx_map = NULL;
+	f->tile_cached = NULL;
+	f->transfer_lut = NULL;
+	f->transfer_lut8 = NULL;
 }
 
 #endif // defined J40_IMPLEMENTATION
@@ -5368,6 +5799,15 @@ J40__STATIC_RETURNS_ERR j40__frame_header(j40__st *st) {
 	}
 	J40__RAISE_DELAYED();
 
+	// streaming only bounds the memory of regular VarDCT frames without extra channels,
+	// every other frame is kept as a whole and should fit in the usual limits
+	if (st->limits == &J40__MAIN_LV5_STREAMING_LIMITS &&
+		(f->is_modular || im->num_extra_channels > 0 || f->type == J40__FRAME_REFONLY || f->type == J40__FRAME_LF)
+	) {
+		J40__SHOULD(f->width <= J40__MAIN_LV5_LIMITS.width && f->height <= J40__MAIN_LV5_LIMITS.height, "slim");
+		J40__SHOULD((int64_t) f->width * f->height <= J40__MAIN_LV5_LIMITS.pixels, "slim");
+	}
+
 	if (im->xyb_encoded && im->want_icc) f->save_before_ct = 1; // ignores the decoded bit
 	f->grows = j40__ceil_div32(f->height, 1 << f->group_size_shift);
 	f->gcolumns = j40__ceil_div32(f->width, 1 << f->group_size_shift);
@@ -5412,12 +5852,21 @@ typedef struct {
 	int64_t nsections, nsections_read;
 	j40__section *sections;
 	int64_t end_codeoff;
+
+	// sections [0, nsections_prefetched) have been hinted to the source via j40__prefetch_codestream
+	int64_t nsections_prefetched;
+
+	// used by the TOC index (see j40_save_toc_index) to verify and skip the TOC itself
+	int64_t start_bits; // the file offset of the TOC in bits
+	int64_t start_codeoff; // the codestream offset of the byte containing the first TOC bit
+	int64_t data_codeoff; // the codestream offset right past the TOC
 } j40__toc;
 
 J40__STATIC_RETURNS_ERR j40__permutation(
 	j40__st *st, j40__code_st *code, int32_t size, int32_t skip, int32_t **out
 );
 J40_INLINE void j40__apply_permutation(void *targetbuf, void *temp, size_t elemsize, const int32_t *lehmer);
+J40__STATIC_RETURNS_ERR j40__order_sections(j40__st *st, j40__section *sections, j40__toc *toc);
 J40__STATIC_RETURNS_ERR j40__read_toc(j40__st *st, j40__toc *toc);
 J40_STATIC void j40__free_toc(j40__toc *toc);
 
@@ -5476,14 +5925,15 @@ J40_STATIC int j40__compare_section(const void *a, const void *b) {
 	return aa->codeoff < bb->codeoff ? -1 : aa->codeoff > bb->codeoff ? 1 : 0;
 }
 
-J40__STATIC_RETURNS_ERR j40__read_toc(j40__st *st, j40__toc *toc) {
+// sorts sections by codeoff into toc->sections, except that any group section depending on
+// the later LF group section is moved right after that LF group section. sections should be
+// in the unpermuted TOC layout, where LfGlobal and HfGlobal have been marked with codeoff -1
+// and all other codeoffs are non-negative. also used by j40__toc_from_index.
+J40__STATIC_RETURNS_ERR j40__order_sections(j40__st *st, j40__section *sections, j40__toc *toc) {
 	j40__frame_st *f = st->frame;
-
-	int64_t nsections = f->num_passes == 1 && f->num_groups == 1 ? 1 :
-		1 /*lf_global*/ + f->num_lf_groups /*lf_group*/ +
-		1 /*hf_global + hf_pass*/ + f->num_passes * f->num_groups /*group_pass*/;
+	int64_t nsections = 1 + f->num_lf_groups + 1 + (int64_t) f->num_passes * f->num_groups;
 	int64_t nsections2;
-	j40__section *sections = NULL, *sections2 = NULL, temp;
+	j40__section *sections2 = NULL;
 
 	// interleaved linked lists for each LF group; for each LF group `gg` there are three cases:
 	// - no relocated section if `relocs[gg].next == 0` (initial state).
@@ -5493,73 +5943,9 @@ J40__STATIC_RETURNS_ERR j40__read_toc(j40__st *st, j40__toc *toc) {
 	struct reloc { int64_t next; j40__section section; } *relocs = NULL;
 	int64_t nrelocs, relocs_cap;
 
-	int32_t *lehmer = NULL;
-	j40__code_spec codespec = J40__INIT;
-	j40__code_st code = J40__INIT;
 	int64_t i, nremoved;
 	int32_t pass;
 
-	// TODO remove int32_t restrictions
-	J40__SHOULD((uint64_t) nsections <= SIZE_MAX && nsections <= INT32_MAX, "flen");
-
-	if (j40__u(st, 1)) { // permuted
-		J40__TRY(j40__read_code_spec(st, 8, &codespec));
-		j40__init_code(&code, &codespec);
-		J40__TRY(j40__permutation(st, &code, (int32_t) nsections, 0, &lehmer));
-		J40__TRY(j40__finish_and_free_code(st, &code));
-		j40__free_code_spec(&codespec);
-	}
-	J40__TRY(j40__zero_pad_to_byte(st));
-
-	// single section case: no allocation required
-	if (nsections == 1) {
-		toc->single_size = j40__u32(st, 0, 10, 1024, 14, 17408, 22, 4211712, 30);
-		J40__TRY(j40__zero_pad_to_byte(st));
-		toc->lf_global_codeoff = toc->hf_global_codeoff = 0;
-		toc->lf_global_size = toc->hf_global_size = 0;
-		toc->nsections = toc->nsections_read = 0;
-		toc->sections = NULL;
-		J40__SHOULD(j40__add64(j40__codestream_offset(st), toc->single_size, &toc->end_codeoff), "flen");
-		j40__free(lehmer);
-		return 0;
-	}
-
-	J40__TRY_MALLOC(j40__section, &sections, (size_t) nsections);
-	for (i = 0; i < nsections; ++i) {
-		sections[i].size = j40__u32(st, 0, 10, 1024, 14, 17408, 22, 4211712, 30);
-	}
-	J40__TRY(j40__zero_pad_to_byte(st));
-
-	sections[0].codeoff = j40__codestream_offset(st); // all TOC offsets are relative to this point
-	for (i = 1; i < nsections; ++i) {
-		J40__SHOULD(j40__add64(sections[i-1].codeoff, sections[i-1].size, &sections[i].codeoff), "flen");
-	}
-	J40__SHOULD(j40__add64(sections[i-1].codeoff, sections[i-1].size, &toc->end_codeoff), "flen");
-
-	if (lehmer) {
-		j40__apply_permutation(sections, &temp, sizeof(j40__section), lehmer);
-		j40__free(lehmer);
-		lehmer = NULL;
-	}
-
-	toc->lf_global_codeoff = sections[0].codeoff;
-	toc->lf_global_size = sections[0].size;
-	sections[0].codeoff = -1;
-	for (i = 0; i < f->num_lf_groups; ++i) {
-		sections[i + 1].pass = -1;
-		sections[i + 1].idx = i;
-	}
-	toc->hf_global_codeoff = sections[f->num_lf_groups + 1].codeoff;
-	toc->hf_global_size = sections[f->num_lf_groups + 1].size;
-	sections[f->num_lf_groups + 1].codeoff = -1;
-	for (pass = 0; pass < f->num_passes; ++pass) {
-		int64_t sectionid = 1 + f->num_lf_groups + 1 + pass * f->num_groups;
-		for (i = 0; i < f->num_groups; ++i) {
-			sections[sectionid + i].pass = pass;
-			sections[sectionid + i].idx = i;
-		}
-	}
-
 	// any group section depending on the later LF group section is temporarily moved to relocs
 	{
 		int32_t ggrow, ggcolumn;
@@ -5628,63 +6014,152 @@ J40__STATIC_RETURNS_ERR j40__read_toc(j40__st *st, j40__toc *toc) {
 	toc->sections = sections2;
 	toc->nsections = nsections2;
 	toc->nsections_read = 0;
+	toc->nsections_prefetched = 0;
 	J40__ASSERT(nsections2 == nsections - 2); // excludes LfGlobal and HfGlobal
 
-	j40__free(sections);
 	j40__free(relocs);
-	j40__free(lehmer);
-	j40__free_code(&code);
-	j40__free_code_spec(&codespec);
 	return 0;
 
 J40__ON_ERROR:
-	j40__free(sections);
 	j40__free(sections2);
 	j40__free(relocs);
-	j40__free(lehmer);
-	j40__free_code(&code);
-	j40__free_code_spec(&codespec);
 	return st->err;
 }
 
-J40_STATIC void j40__free_toc(j40__toc *toc) {
-	j40__free(toc->sections);
-	toc->sections = NULL;
-}
+J40__STATIC_RETURNS_ERR j40__read_toc(j40__st *st, j40__toc *toc) {
+	j40__frame_st *f = st->frame;
 
-#endif // defined J40_IMPLEMENTATION
+	int64_t nsections = f->num_passes == 1 && f->num_groups == 1 ? 1 :
+		1 /*lf_global*/ + f->num_lf_groups /*lf_group*/ +
+		1 /*hf_global + hf_pass*/ + f->num_passes * f->num_groups /*group_pass*/;
+	j40__section *sections = NULL, temp;
+	int32_t *lehmer = NULL;
+	j40__code_spec codespec = J40__INIT;
+	j40__code_st code = J40__INIT;
+	int64_t i;
+	int32_t pass;
 
-////////////////////////////////////////////////////////////////////////////////
-// DCT
+	// TODO remove int32_t restrictions
+	J40__SHOULD((uint64_t) nsections <= SIZE_MAX && nsections <= INT32_MAX, "flen");
 
-// both use `in` as a scratch space as well, so `in` will be altered after return
-J40_STATIC void j40__forward_dct_unscaled(
-	float *J40_RESTRICT out, float *J40_RESTRICT in, int32_t t, int32_t rep
-);
-J40_STATIC void j40__inverse_dct(
-	float *J40_RESTRICT out, float *J40_RESTRICT in, int32_t t, int32_t rep
-);
+	toc->start_bits = j40__bits_read(st);
+	toc->start_codeoff = j40__bits_codeoff(st);
+	if (j40__u(st, 1)) { // permuted
+		J40__TRY(j40__read_code_spec(st, 8, &codespec));
+		j40__init_code(&code, &codespec);
+		J40__TRY(j40__permutation(st, &code, (int32_t) nsections, 0, &lehmer));
+		J40__TRY(j40__finish_and_free_code(st, &code));
+		j40__free_code_spec(&codespec);
+	}
+	J40__TRY(j40__zero_pad_to_byte(st));
 
-J40_STATIC void j40__forward_dct2d_scaled_for_llf(
-	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
-);
-J40_STATIC void j40__inverse_dct2d(
-	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
-);
+	// single section case: no allocation required
+	if (nsections == 1) {
+		toc->single_size = j40__u32(st, 0, 10, 1024, 14, 17408, 22, 4211712, 30);
+		J40__TRY(j40__zero_pad_to_byte(st));
+		toc->data_codeoff = j40__codestream_offset(st);
+		toc->lf_global_codeoff = toc->hf_global_codeoff = 0;
+		toc->lf_global_size = toc->hf_global_size = 0;
+		toc->nsections = toc->nsections_read = toc->nsections_prefetched = 0;
+		toc->sections = NULL;
+		J40__SHOULD(j40__add64(j40__codestream_offset(st), toc->single_size, &toc->end_codeoff), "flen");
+		j40__free(lehmer);
+		return 0;
+	}
 
-J40_STATIC void j40__inverse_dct11(float *buf);
-J40_STATIC void j40__inverse_dct22(float *buf);
-J40_STATIC void j40__inverse_hornuss(float *buf);
-J40_STATIC void j40__inverse_dct32(float *buf);
-J40_STATIC void j40__inverse_dct23(float *buf);
-J40_STATIC void j40__inverse_afv22(float *J40_RESTRICT out, float *J40_RESTRICT in);
-J40_STATIC void j40__inverse_afv(float *buf, int flipx, int flipy);
+	J40__TRY_MALLOC(j40__section, &sections, (size_t) nsections);
+	for (i = 0; i < nsections; ++i) {
+		sections[i].size = j40__u32(st, 0, 10, 1024, 14, 17408, 22, 4211712, 30);
+	}
+	J40__TRY(j40__zero_pad_to_byte(st));
 
-#ifdef J40_IMPLEMENTATION
+	sections[0].codeoff = toc->data_codeoff = j40__codestream_offset(st); // all TOC offsets are relative to this point
+	for (i = 1; i < nsections; ++i) {
+		J40__SHOULD(j40__add64(sections[i-1].codeoff, sections[i-1].size, &sections[i].codeoff), "flen");
+	}
+	J40__SHOULD(j40__add64(sections[i-1].codeoff, sections[i-1].size, &toc->end_codeoff), "flen");
 
-// this is more or less a direct translation of mcos2/3 algorithms described in:
-// Perera, S. M., & Liu, J. (2018). Lowest Complexity Self-Recursive Radix-2 DCT II/III Algorithms.
-// SIAM Journal on Matrix Analysis and Applications, 39(2), 664--682.
+	if (lehmer) {
+		j40__apply_permutation(sections, &temp, sizeof(j40__section), lehmer);
+		j40__free(lehmer);
+		lehmer = NULL;
+	}
+
+	toc->lf_global_codeoff = sections[0].codeoff;
+	toc->lf_global_size = sections[0].size;
+	sections[0].codeoff = -1;
+	for (i = 0; i < f->num_lf_groups; ++i) {
+		sections[i + 1].pass = -1;
+		sections[i + 1].idx = i;
+	}
+	toc->hf_global_codeoff = sections[f->num_lf_groups + 1].codeoff;
+	toc->hf_global_size = sections[f->num_lf_groups + 1].size;
+	sections[f->num_lf_groups + 1].codeoff = -1;
+	for (pass = 0; pass < f->num_passes; ++pass) {
+		int64_t sectionid = 1 + f->num_lf_groups + 1 + pass * f->num_groups;
+		for (i = 0; i < f->num_groups; ++i) {
+			sections[sectionid + i].pass = pass;
+			sections[sectionid + i].idx = i;
+		}
+	}
+
+	J40__TRY(j40__order_sections(st, sections, toc));
+
+	j40__free(sections);
+	j40__free(lehmer);
+	j40__free_code(&code);
+	j40__free_code_spec(&codespec);
+	return 0;
+
+J40__ON_ERROR:
+	j40__free(sections);
+	j40__free(lehmer);
+	j40__free_code(&code);
+	j40__free_code_spec(&codespec);
+	return st->err;
+}
+
+J40_STATIC void j40__free_toc(j40__toc *toc) {
+	j40__free(toc->sections);
+	toc->sections = NULL;
+}
+
+#endif // defined J40_IMPLEMENTATION
+
+////////////////////////////////////////////////////////////////////////////////
+// DCT
+
+// both use `in` as a scratch space as well, so `in` will be altered after return
+J40_STATIC void j40__forward_dct_unscaled(
+	float *J40_RESTRICT out, float *J40_RESTRICT in, int32_t t, int32_t rep
+);
+J40_STATIC void j40__inverse_dct(
+	float *J40_RESTRICT out, float *J40_RESTRICT in, int32_t t, int32_t rep
+);
+
+J40_STATIC void j40__forward_dct2d_scaled_for_llf(
+	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
+);
+J40_STATIC void j40__inverse_dct2d(
+	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
+);
+J40_STATIC void j40__inverse_dct2d_llf(
+	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
+);
+
+J40_STATIC void j40__inverse_dct11(float *buf);
+J40_STATIC void j40__inverse_dct22(float *buf);
+J40_STATIC void j40__inverse_hornuss(float *buf);
+J40_STATIC void j40__inverse_dct32(float *buf);
+J40_STATIC void j40__inverse_dct23(float *buf);
+J40_STATIC void j40__inverse_afv22(float *J40_RESTRICT out, float *J40_RESTRICT in);
+J40_STATIC void j40__inverse_afv(float *buf, int flipx, int flipy);
+
+#ifdef J40_IMPLEMENTATION
+
+// this is more or less a direct translation of mcos2/3 algorithms described in:
+// Perera, S. M., & Liu, J. (2018). Lowest Complexity Self-Recursive Radix-2 DCT II/III Algorithms.
+// SIAM Journal on Matrix Analysis and Applications, 39(2), 664--682.
 
 // [(1<<n) + k] = 1/(2 cos((k+0.5)/2^(n+1) pi)) for n >= 1 and 0 <= k < 2^n
 J40_STATIC const float J40__HALF_SECANTS[256] = {
@@ -5899,36 +6374,103 @@ J40_ALWAYS_INLINE void j40__inverse_dct4(J40__DCT_ARGS, int32_t rep1, int32_t re
 	j40__inverse_dct_core(out, in, 2, rep1, rep2, j40__dct2);
 }
 
-J40_STATIC void j40__inverse_dct_recur(J40__DCT_ARGS, int32_t rep1, int32_t rep2) {
-	if (t < 4) {
-		J40__ASSERT(t == 3);
-		j40__inverse_dct_core(out, in, 3, rep1, rep2, j40__inverse_dct4);
-	} else {
-		j40__inverse_dct_core(out, in, t, rep1, rep2, j40__inverse_dct_recur);
-	}
+#endif // defined J40_IMPLEMENTATION
+
+// ----------------------------------------
+// recursion for inverse DCT sizes (8 to 256), so that each size gets its own kernel where
+// every loop bound and J40__HALF_SECANTS index is a constant and the butterfly network can be unrolled
+#undef J40__RECURSING
+#define J40__RECURSING 500
+#define J40__N 8
+#define J40__T 3
+#define J40__HALF j40__inverse_dct4
+#define J40__HALF_X8 j40__inverse_dct4
+#include J40_FILENAME
+#define J40__N 16
+#define J40__T 4
+#define J40__HALF j40__inverse_dct_x1_8
+#define J40__HALF_X8 j40__inverse_dct_x8_8
+#include J40_FILENAME
+#define J40__N 32
+#define J40__T 5
+#define J40__HALF j40__inverse_dct_x1_16
+#define J40__HALF_X8 j40__inverse_dct_x8_16
+#include J40_FILENAME
+#define J40__N 64
+#define J40__T 6
+#define J40__HALF j40__inverse_dct_x1_32
+#define J40__HALF_X8 j40__inverse_dct_x8_32
+#include J40_FILENAME
+#define J40__N 128
+#define J40__T 7
+#define J40__HALF j40__inverse_dct_x1_64
+#define J40__HALF_X8 j40__inverse_dct_x8_64
+#include J40_FILENAME
+#define J40__N 256
+#define J40__T 8
+#define J40__HALF j40__inverse_dct_x1_128
+#define J40__HALF_X8 j40__inverse_dct_x8_128
+#include J40_FILENAME
+#undef J40__RECURSING
+#define J40__RECURSING (-1)
+
+#endif // J40__RECURSING < 0
+#if J40__RECURSING == 500
+// ----------------------------------------
+
+#ifdef J40_IMPLEMENTATION
+
+J40_STATIC void j40__(inverse_dct_x1_,N)(J40__DCT_ARGS, int32_t rep1, int32_t rep2) {
+	J40__ASSERT(t == J40__T && rep2 == 1); (void) t; (void) rep2;
+	j40__inverse_dct_core(out, in, J40__T, rep1, 1, J40__HALF);
 }
 
-J40_STATIC void j40__inverse_dct_recur_x8(J40__DCT_ARGS, int32_t rep1, int32_t rep2) {
-	J40__ASSERT(rep2 == 8); (void) rep2;
-	if (t < 4) {
-		J40__ASSERT(t == 3);
-		j40__inverse_dct_core(out, in, 3, rep1, 8, j40__inverse_dct4);
-	} else {
-		j40__inverse_dct_core(out, in, t, rep1, 8, j40__inverse_dct_recur_x8);
-	}
+J40_STATIC void j40__(inverse_dct_x8_,N)(J40__DCT_ARGS, int32_t rep1, int32_t rep2) {
+	J40__ASSERT(t == J40__T && rep2 == 8); (void) t; (void) rep2;
+	j40__inverse_dct_core(out, in, J40__T, rep1, 8, J40__HALF_X8);
 }
 
+#endif // defined J40_IMPLEMENTATION
+
+// ----------------------------------------
+// end of recursion
+	#undef J40__N
+	#undef J40__T
+	#undef J40__HALF
+	#undef J40__HALF_X8
+#endif // J40__RECURSING == 500
+#if J40__RECURSING < 0
+// ----------------------------------------
+
+#ifdef J40_IMPLEMENTATION
+
 J40_STATIC void j40__inverse_dct(J40__DCT_ARGS, int32_t rep) {
 	if (t <= 0) {
 		memcpy(out, in, sizeof(float) * (size_t) rep);
 	} else if (rep % 8 == 0) {
-		if (t == 1) j40__dct2(out, in, 1, rep / 8, 8);
-		else if (t == 2) j40__inverse_dct4(out, in, 2, rep / 8, 8);
-		else j40__inverse_dct_recur_x8(out, in, t, rep / 8, 8);
+		switch (t) {
+		case 1: j40__dct2(out, in, 1, rep / 8, 8); break;
+		case 2: j40__inverse_dct4(out, in, 2, rep / 8, 8); break;
+		case 3: j40__inverse_dct_x8_8(out, in, 3, rep / 8, 8); break;
+		case 4: j40__inverse_dct_x8_16(out, in, 4, rep / 8, 8); break;
+		case 5: j40__inverse_dct_x8_32(out, in, 5, rep / 8, 8); break;
+		case 6: j40__inverse_dct_x8_64(out, in, 6, rep / 8, 8); break;
+		case 7: j40__inverse_dct_x8_128(out, in, 7, rep / 8, 8); break;
+		case 8: j40__inverse_dct_x8_256(out, in, 8, rep / 8, 8); break;
+		default: J40__UNREACHABLE();
+		}
 	} else {
-		if (t == 1) j40__dct2(out, in, 1, rep, 1);
-		else if (t == 2) j40__inverse_dct4(out, in, 2, rep, 1);
-		else j40__inverse_dct_recur(out, in, t, rep, 1);
+		switch (t) {
+		case 1: j40__dct2(out, in, 1, rep, 1); break;
+		case 2: j40__inverse_dct4(out, in, 2, rep, 1); break;
+		case 3: j40__inverse_dct_x1_8(out, in, 3, rep, 1); break;
+		case 4: j40__inverse_dct_x1_16(out, in, 4, rep, 1); break;
+		case 5: j40__inverse_dct_x1_32(out, in, 5, rep, 1); break;
+		case 6: j40__inverse_dct_x1_64(out, in, 6, rep, 1); break;
+		case 7: j40__inverse_dct_x1_128(out, in, 7, rep, 1); break;
+		case 8: j40__inverse_dct_x1_256(out, in, 8, rep, 1); break;
+		default: J40__UNREACHABLE();
+		}
 	}
 }
 
@@ -5989,6 +6531,47 @@ J40_STATIC void j40__inverse_dct2d(
 	J40__ASSERT(bufv.logw == log_columns && bufv.logh == log_rows);
 }
 
+// j40__inverse_dct2d for blocks with LLF coefficients only (the top-left 1/8 by 1/8, see there for the layout).
+// DC-only blocks are filled with the DC coefficient, which is exact. otherwise the first pass only
+// transforms columns with any LLF coefficient; columns are independent so the result is same.
+J40_STATIC void j40__inverse_dct2d_llf(
+	float *J40_RESTRICT buf, float *J40_RESTRICT scratch, int32_t log_rows, int32_t log_columns
+) {
+	int32_t logw = j40__max32(log_rows, log_columns), logh = j40__min32(log_rows, log_columns);
+	int32_t logl, logk, logsw, x, y, dc_only = 1;
+	j40__view_f32 bufv, scratchv;
+	float *out;
+
+	for (y = 0; y < 1 << (logh - 3); ++y) for (x = 0; x < 1 << (logw - 3); ++x) {
+		if ((x || y) && buf[y << logw | x] != 0.0f) dc_only = 0;
+	}
+	if (dc_only) {
+		for (x = 1; x < 1 << (logw + logh); ++x) buf[x] = buf[0];
+		return;
+	}
+
+	// gather columns of the (transposed or copied) first pass input with LLF coefficients into `scratch`.
+	// the first pass transforms columns of length 2^logl, and only 2^logk columns are nonzero.
+	logl = log_columns > log_rows ? logw : logh;
+	logsw = log_columns > log_rows ? logh : logw;
+	logk = logsw - 3;
+	for (y = 0; y < 1 << logl; ++y) for (x = 0; x < 1 << logk; ++x) {
+		scratch[y << logk | x] = y >= 1 << (logl - 3) ? 0.0f :
+			log_columns > log_rows ? buf[x << logw | y] : buf[y << logw | x];
+	}
+	out = scratch + (1 << (logl + logk));
+	j40__inverse_dct(out, scratch, logl, 1 << logk);
+	for (y = 0; y < 1 << logl; ++y) for (x = 0; x < 1 << logsw; ++x) {
+		buf[y << logsw | x] = x < 1 << logk ? out[y << logk | x] : 0.0f;
+	}
+
+	bufv = j40__make_view_f32(logsw, logl, buf);
+	scratchv = j40__make_view_f32(logsw, logl, scratch);
+	j40__transpose_view_f32(&scratchv, bufv);
+	j40__inverse_dct_view(&bufv, &scratchv);
+	J40__ASSERT(bufv.logw == log_columns && bufv.logh == log_rows);
+}
+
 // a single iteration of AuxIDCT2x2
 J40_ALWAYS_INLINE void j40__aux_inverse_dct11(float *out, float *in, int32_t x, int32_t y, int32_t S2) {
 	int32_t p = y * 8 + x, q = (y * 2) * 8 + (x * 2);
@@ -5999,17 +6582,39 @@ J40_ALWAYS_INLINE void j40__aux_inverse_dct11(float *out, float *in, int32_t x,
 	out[q + 011] = c00 - c01 - c10 + c11; // r11
 }
 
+// all iterations of AuxIDCT2x2 for given S2 (2 or 4); each row of cells is computed as S2 lanes
+// and then interleaved into two output rows, so that the arithmetic itself can be vectorized
+J40_ALWAYS_INLINE void j40__aux_inverse_dct11_rows(float *J40_RESTRICT out, const float *J40_RESTRICT in, int32_t S2) {
+	int32_t x, y;
+	for (y = 0; y < S2; ++y) {
+		const float *row0 = in + y * 8, *row1 = in + (y + S2) * 8;
+		float r00[4], r01[4], r10[4], r11[4];
+		for (x = 0; x < S2; ++x) {
+			float c00 = row0[x], c01 = row0[x + S2], c10 = row1[x], c11 = row1[x + S2];
+			r00[x] = c00 + c01 + c10 + c11;
+			r01[x] = c00 + c01 - c10 - c11;
+			r10[x] = c00 - c01 + c10 - c11;
+			r11[x] = c00 - c01 - c10 + c11;
+		}
+		for (x = 0; x < S2; ++x) {
+			out[(y * 2) * 8 + (x * 2)] = r00[x];
+			out[(y * 2) * 8 + (x * 2 + 1)] = r01[x];
+			out[(y * 2 + 1) * 8 + (x * 2)] = r10[x];
+			out[(y * 2 + 1) * 8 + (x * 2 + 1)] = r11[x];
+		}
+	}
+}
+
 J40_STATIC void j40__inverse_dct11(float *buf) {
 	float scratch[64];
-	int32_t x, y;
 
 	// TODO spec issue: only the "top-left" SxS cells, not "top"
 	j40__aux_inverse_dct11(buf, buf, 0, 0, 1); // updates buf[(0..1)*8+(0..1)]
 	// updates scratch[(0..3)*8+(0..3)], copying other elements from buf in verbatim
 	memcpy(scratch, buf, sizeof(float) * 64);
-	for (y = 0; y < 2; ++y) for (x = 0; x < 2; ++x) j40__aux_inverse_dct11(scratch, buf, x, y, 2);
+	j40__aux_inverse_dct11_rows(scratch, buf, 2);
 	// updates the entire buf
-	for (y = 0; y < 4; ++y) for (x = 0; x < 4; ++x) j40__aux_inverse_dct11(buf, scratch, x, y, 4);
+	j40__aux_inverse_dct11_rows(buf, scratch, 4);
 }
 
 J40_STATIC void j40__inverse_dct22(float *buf) {
@@ -6049,17 +6654,20 @@ J40_STATIC void j40__inverse_hornuss(float *buf) {
 	memcpy(scratch, buf, sizeof(float) * 64);
 	j40__aux_inverse_dct11(scratch, buf, 0, 0, 1); // updates scratch[(0..1)*8+(0..1)]
 	for (y = 0; y < 2; ++y) for (x = 0; x < 2; ++x) {
-		int32_t pos00 = y * 8 + x, pos11 = (y + 2) * 8 + (x + 2);
-		float rsum[4] = {0}, sample11;
+		// cells for this 4x4 output are interleaved in scratch; gathering them first turns
+		// the remaining sums and the final broadcast add into plain 4-lane row operations.
+		// cells[0] and cells[5] correspond to pos00 = (y, x) and pos11 = (y + 2, x + 2).
+		float cells[16], rsum[4] = {0}, sample11;
 		for (iy = 0; iy < 4; ++iy) for (ix = 0; ix < 4; ++ix) {
-			rsum[ix] += scratch[(y + iy * 2) * 8 + (x + ix * 2)];
+			cells[iy * 4 + ix] = scratch[(y + iy * 2) * 8 + (x + ix * 2)];
 		}
+		for (iy = 0; iy < 4; ++iy) for (ix = 0; ix < 4; ++ix) rsum[ix] += cells[iy * 4 + ix];
 		// conceptually (SUM rsum[i]) = residual_sum + coefficients(x, y) in the spec
-		sample11 = scratch[pos00] - (rsum[0] + rsum[1] + rsum[2] + rsum[3] - scratch[pos00]) * 0.0625f;
-		scratch[pos00] = scratch[pos11];
-		scratch[pos11] = 0.0f;
+		sample11 = cells[0] - (rsum[0] + rsum[1] + rsum[2] + rsum[3] - cells[0]) * 0.0625f;
+		cells[0] = cells[5];
+		cells[5] = 0.0f;
 		for (iy = 0; iy < 4; ++iy) for (ix = 0; ix < 4; ++ix) {
-			buf[(4 * y + iy) * 8 + (4 * x + ix)] = scratch[(y + iy * 2) * 8 + (x + ix * 2)] + sample11;
+			buf[(4 * y + iy) * 8 + (4 * x + ix)] = cells[iy * 4 + ix] + sample11;
 		}
 	}
 }
@@ -6105,78 +6713,80 @@ J40_STATIC void j40__inverse_dct23(float *buf) {
 
 // TODO spec issue: the input is a 4x4 matrix but indexed like a 1-dimensional array
 J40_STATIC void j40__inverse_afv22(float *J40_RESTRICT out, float *J40_RESTRICT in) {
-	static const float AFV_BASIS[256] = { // AFVBasis in the specification, but transposed
-		 0.25000000f,  0.87690293f,  0.00000000f,  0.00000000f,
-		 0.00000000f, -0.41053776f,  0.00000000f,  0.00000000f,
-		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.25000000f,  0.22065181f,  0.00000000f,  0.00000000f,
-		-0.70710678f,  0.62354854f,  0.00000000f,  0.00000000f,
-		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
+	static const float AFV_BASIS[256] = { // AFVBasis in the specification
+		 0.25000000f,  0.25000000f,  0.25000000f,  0.25000000f,
+		 0.25000000f,  0.25000000f,  0.25000000f,  0.25000000f,
+		 0.25000000f,  0.25000000f,  0.25000000f,  0.25000000f,
+		 0.25000000f,  0.25000000f,  0.25000000f,  0.25000000f,
+		 0.87690293f,  0.22065181f, -0.10140050f, -0.10140050f,
+		 0.22065181f, -0.10140050f, -0.10140050f, -0.10140050f,
+		-0.10140050f, -0.10140050f, -0.10140050f, -0.10140050f,
+		-0.10140050f, -0.10140050f, -0.10140050f, -0.10140050f,
+		 0.00000000f,  0.00000000f,  0.40670076f,  0.44444817f,
+		 0.00000000f,  0.00000000f,  0.19574399f,  0.29291001f,
+		-0.40670076f, -0.19574399f,  0.00000000f,  0.11379074f,
+		-0.44444817f, -0.29291001f, -0.11379074f,  0.00000000f,
+		 0.00000000f,  0.00000000f, -0.21255748f,  0.30854971f,
+		 0.00000000f,  0.47067023f, -0.16212052f,  0.00000000f,
+		-0.21255748f, -0.16212052f, -0.47067023f, -0.14642919f,
+		 0.30854971f,  0.00000000f, -0.14642919f,  0.42511496f,
+		 0.00000000f, -0.70710678f,  0.00000000f,  0.00000000f,
+		 0.70710678f,  0.00000000f,  0.00000000f,  0.00000000f,
 		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.25000000f, -0.10140050f,  0.40670076f, -0.21255748f,
-		 0.00000000f, -0.06435072f, -0.45175566f, -0.30468475f,
-		 0.30179295f,  0.40824829f,  0.17478670f, -0.21105601f,
-		-0.14266085f, -0.13813540f, -0.17437603f,  0.11354987f,
-		 0.25000000f, -0.10140050f,  0.44444817f,  0.30854971f,
-		 0.00000000f, -0.06435072f,  0.15854504f,  0.51126161f,
-		 0.25792363f,  0.00000000f,  0.08126112f,  0.18567181f,
-		-0.34164468f,  0.33022826f,  0.07027907f, -0.07417505f,
-		 0.25000000f,  0.22065181f,  0.00000000f,  0.00000000f,
-		 0.70710678f,  0.62354854f,  0.00000000f,  0.00000000f,
 		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.00000000f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.25000000f, -0.10140050f,  0.00000000f,  0.47067023f,
-		 0.00000000f, -0.06435072f, -0.04038515f,  0.00000000f,
-		 0.16272340f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.73674975f,  0.08755115f, -0.29210266f,  0.19402893f,
-		 0.25000000f, -0.10140050f,  0.19574399f, -0.16212052f,
-		 0.00000000f, -0.06435072f,  0.00741823f, -0.29048013f,
-		 0.09520023f,  0.00000000f, -0.36753980f,  0.49215859f,
-		 0.24627108f, -0.07946707f,  0.36238173f, -0.43519050f,
-		 0.25000000f, -0.10140050f,  0.29291001f,  0.00000000f,
-		 0.00000000f, -0.06435072f,  0.39351034f, -0.06578702f,
-		 0.00000000f, -0.40824829f, -0.30788221f, -0.38525014f,
-		-0.08574019f, -0.46133749f,  0.00000000f,  0.21918685f,
-		 0.25000000f, -0.10140050f, -0.40670076f, -0.21255748f,
-		 0.00000000f, -0.06435072f, -0.45175566f,  0.30468475f,
-		 0.30179295f, -0.40824829f, -0.17478670f,  0.21105601f,
-		-0.14266085f, -0.13813540f, -0.17437603f,  0.11354987f,
-		 0.25000000f, -0.10140050f, -0.19574399f, -0.16212052f,
-		 0.00000000f, -0.06435072f,  0.00741823f,  0.29048013f,
-		 0.09520023f,  0.00000000f,  0.36753980f, -0.49215859f,
-		 0.24627108f, -0.07946707f,  0.36238173f, -0.43519050f,
-		 0.25000000f, -0.10140050f,  0.00000000f, -0.47067023f,
-		 0.00000000f, -0.06435072f,  0.11074166f,  0.00000000f,
-		-0.16272340f,  0.00000000f,  0.00000000f,  0.00000000f,
-		 0.14883399f,  0.49724647f,  0.29210266f,  0.55504438f,
-		 0.25000000f, -0.10140050f,  0.11379074f, -0.14642919f,
-		 0.00000000f, -0.06435072f,  0.08298163f, -0.23889774f,
-		-0.35312385f, -0.40824829f,  0.48266891f,  0.17419413f,
-		-0.04768680f,  0.12538059f, -0.43266080f, -0.25468277f,
-		 0.25000000f, -0.10140050f, -0.44444817f,  0.30854971f,
-		 0.00000000f, -0.06435072f,  0.15854504f, -0.51126161f,
-		 0.25792363f,  0.00000000f, -0.08126112f, -0.18567181f,
-		-0.34164468f,  0.33022826f,  0.07027907f, -0.07417505f,
-		 0.25000000f, -0.10140050f, -0.29291001f,  0.00000000f,
-		 0.00000000f, -0.06435072f,  0.39351034f,  0.06578702f,
-		 0.00000000f,  0.40824829f,  0.30788221f,  0.38525014f,
-		-0.08574019f, -0.46133749f,  0.00000000f,  0.21918685f,
-		 0.25000000f, -0.10140050f, -0.11379074f, -0.14642919f,
-		 0.00000000f, -0.06435072f,  0.08298163f,  0.23889774f,
-		-0.35312385f,  0.40824829f, -0.48266891f, -0.17419413f,
-		-0.04768680f,  0.12538059f, -0.43266080f, -0.25468277f,
-		 0.25000000f, -0.10140050f,  0.00000000f,  0.42511496f,
-		 0.00000000f, -0.06435072f, -0.45175566f,  0.00000000f,
-		-0.60358590f,  0.00000000f,  0.00000000f,  0.00000000f,
-		-0.14266085f, -0.13813540f,  0.34875205f,  0.11354987f,
+		-0.41053776f,  0.62354854f, -0.06435072f, -0.06435072f,
+		 0.62354854f, -0.06435072f, -0.06435072f, -0.06435072f,
+		-0.06435072f, -0.06435072f, -0.06435072f, -0.06435072f,
+		-0.06435072f, -0.06435072f, -0.06435072f, -0.06435072f,
+		 0.00000000f,  0.00000000f, -0.45175566f,  0.15854504f,
+		 0.00000000f, -0.04038515f,  0.00741823f,  0.39351034f,
+		-0.45175566f,  0.00741823f,  0.11074166f,  0.08298163f,
+		 0.15854504f,  0.39351034f,  0.08298163f, -0.45175566f,
+		 0.00000000f,  0.00000000f, -0.30468475f,  0.51126161f,
+		 0.00000000f,  0.00000000f, -0.29048013f, -0.06578702f,
+		 0.30468475f,  0.29048013f,  0.00000000f, -0.23889774f,
+		-0.51126161f,  0.06578702f,  0.23889774f,  0.00000000f,
+		 0.00000000f,  0.00000000f,  0.30179295f,  0.25792363f,
+		 0.00000000f,  0.16272340f,  0.09520023f,  0.00000000f,
+		 0.30179295f,  0.09520023f, -0.16272340f, -0.35312385f,
+		 0.25792363f,  0.00000000f, -0.35312385f, -0.60358590f,
+		 0.00000000f,  0.00000000f,  0.40824829f,  0.00000000f,
+		 0.00000000f,  0.00000000f,  0.00000000f, -0.40824829f,
+		-0.40824829f,  0.00000000f,  0.00000000f, -0.40824829f,
+		 0.00000000f,  0.40824829f,  0.40824829f,  0.00000000f,
+		 0.00000000f,  0.00000000f,  0.17478670f,  0.08126112f,
+		 0.00000000f,  0.00000000f, -0.36753980f, -0.30788221f,
+		-0.17478670f,  0.36753980f,  0.00000000f,  0.48266891f,
+		-0.08126112f,  0.30788221f, -0.48266891f,  0.00000000f,
+		 0.00000000f,  0.00000000f, -0.21105601f,  0.18567181f,
+		 0.00000000f,  0.00000000f,  0.49215859f, -0.38525014f,
+		 0.21105601f, -0.49215859f,  0.00000000f,  0.17419413f,
+		-0.18567181f,  0.38525014f, -0.17419413f,  0.00000000f,
+		 0.00000000f,  0.00000000f, -0.14266085f, -0.34164468f,
+		 0.00000000f,  0.73674975f,  0.24627108f, -0.08574019f,
+		-0.14266085f,  0.24627108f,  0.14883399f, -0.04768680f,
+		-0.34164468f, -0.08574019f, -0.04768680f, -0.14266085f,
+		 0.00000000f,  0.00000000f, -0.13813540f,  0.33022826f,
+		 0.00000000f,  0.08755115f, -0.07946707f, -0.46133749f,
+		-0.13813540f, -0.07946707f,  0.49724647f,  0.12538059f,
+		 0.33022826f, -0.46133749f,  0.12538059f, -0.13813540f,
+		 0.00000000f,  0.00000000f, -0.17437603f,  0.07027907f,
+		 0.00000000f, -0.29210266f,  0.36238173f,  0.00000000f,
+		-0.17437603f,  0.36238173f,  0.29210266f, -0.43266080f,
+		 0.07027907f,  0.00000000f, -0.43266080f,  0.34875205f,
+		 0.00000000f,  0.00000000f,  0.11354987f, -0.07417505f,
+		 0.00000000f,  0.19402893f, -0.43519050f,  0.21918685f,
+		 0.11354987f, -0.43519050f,  0.55504438f, -0.25468277f,
+		-0.07417505f,  0.21918685f, -0.25468277f,  0.11354987f,
 	};
 
+	// each input coefficient scales one contiguous basis row, so all 16 outputs are accumulated
+	// at once; the summation order per output is unchanged from the plain matrix product
 	int32_t i, j;
-	for (i = 0; i < 16; ++i) {
-		float sum = 0.0f;
-		for (j = 0; j < 16; ++j) sum += in[j] * AFV_BASIS[i * 16 + j];
-		out[i] = sum;
+	for (i = 0; i < 16; ++i) out[i] = 0.0f;
+	for (j = 0; j < 16; ++j) {
+		float c = in[j];
+		for (i = 0; i < 16; ++i) out[i] += c * AFV_BASIS[j * 16 + i];
 	}
 }
 
@@ -6357,6 +6967,12 @@ typedef struct {
 	// DctSelect is embedded in blocks
 } j40__varblock;
 
+// HF coefficients are stored sparsely, as most of them are zero at typical distances. each pass appends
+// a run of nonzero quantized coefficients for each varblock and channel, and runs for the same varblock
+// and channel are chained in the reverse order. they are expanded and dequantized only when combined.
+typedef struct { int32_t pos, value; } j40__hf_coeff; // `pos` is in the natural order within the varblock
+typedef struct { int32_t next, start, count; } j40__hf_run; // `next` is -1 for the first run
+
 typedef struct j40__lf_group_st {
 	int64_t idx;
 
@@ -6378,15 +6994,19 @@ typedef struct j40__lf_group_st {
 	j40__varblock *varblocks; // [nb_varblocks]
 
 	float *llfcoeffs[3]; // [width8*height8] each
-	// TODO coeffs can be integers before dequantization
-	float *coeffs[3]; // [width8*height8*64] each, aligned
-	#define J40__COEFFS_ALIGN 64
-	uint8_t coeffs_misalign[3];
+	int32_t *hf_heads; // [nb_varblocks*3], index to the last j40__hf_run per varblock and channel or -1
+	j40__hf_run *hf_runs;
+	j40__hf_coeff *hf_coeffs;
+	int32_t num_hf_runs, hf_runs_cap, num_hf_coeffs, hf_coeffs_cap;
 
 	// precomputed lf_idx
 	j40__plane lfindices; // [width8*height8]
 
-	int loaded;
+	// dequantized and smoothed LF image (XYB), only kept if `frame->keep_lf` is set
+	j40__plane lfquant[3]; // width8 x height8 each
+
+	int loaded, combined;
+	int64_t num_pass_groups_read; // complete when this reaches `grows * gcolumns * num_passes`
 } j40__lf_group_st;
 
 J40__STATIC_RETURNS_ERR j40__lf_quant(
@@ -6396,7 +7016,10 @@ J40__STATIC_RETURNS_ERR j40__hf_metadata(
 	j40__st *st, int32_t nb_varblocks,
 	j40__modular *m, const j40__plane lfquant[3], j40__lf_group_st *gg
 );
+J40__STATIC_RETURNS_ERR j40__allocate_coeffs(j40__st *st, j40__lf_group_st *gg);
 J40__STATIC_RETURNS_ERR j40__lf_group(j40__st *st, j40__lf_group_st *gg);
+J40_INLINE int j40__group_in_region(const j40__frame_st *f, int64_t gidx);
+J40_INLINE int j40__lf_group_in_region(const j40__frame_st *f, const j40__lf_group_st *gg);
 J40_STATIC void j40__free_lf_group(j40__lf_group_st *gg);
 
 // ----------------------------------------
@@ -6489,56 +7112,82 @@ J40_STATIC void j40__multiply_each_u8(j40__plane *plane, int32_t mult) {
 	}
 }
 
+// the result goes to a separate set of planes which then replace `lfquant`, so that the unsmoothed
+// neighbors are always available without copying them. columns are processed in fixed-size blocks
+// of independent lanes, with the gap reduced across channels per lane, so that the compiler can
+// vectorize the whole computation.
 J40__STATIC_RETURNS_ERR j40__smooth_lf(j40__st *st, j40__lf_group_st *gg, j40__plane lfquant[3]) {
 	static const float W0 = 0.05226273532324128f, W1 = 0.20345139757231578f, W2 = 0.0334829185968739f;
+	#define J40__SMOOTH_LF_LANES 16
 
 	j40__frame_st *f = st->frame;
 	int32_t ggw8 = gg->width8, ggh8 = gg->height8;
-	float *linebuf = NULL, *nline[3], *line[3];
+	j40__plane smoothed[3] = {J40__INIT};
 	float inv_m_lf[3];
-	int32_t x, y, c;
+	int32_t x, y, c, i;
 
 	for (c = 0; c < 3; ++c) {
 		// TODO spec bug: missing 2^16 scaling
 		inv_m_lf[c] = (float) (f->global_scale * f->quant_lf) / f->m_lf_scaled[c] / 65536.0f;
 	}
 
-	J40__TRY_MALLOC(float, &linebuf, (size_t) (ggw8 * 6));
+	// same size class for all LF groups except for the last column or row, so is recycled via the pool
 	for (c = 0; c < 3; ++c) {
-		nline[c] = linebuf + (c + 3) * ggw8; // intentionally uninitialized
-		line[c] = linebuf + c * ggw8; // row 0
-		memcpy(line[c], J40__F32_PIXELS(&lfquant[c], 0), sizeof(float) * (size_t) ggw8);
+		J40__TRY(j40__init_plane(st, J40__PLANE_F32, ggw8, ggh8, 0, &smoothed[c]));
+		// the first and last rows and columns are not smoothed
+		memcpy(J40__F32_PIXELS(&smoothed[c], 0), J40__F32_PIXELS(&lfquant[c], 0), sizeof(float) * (size_t) ggw8);
+		memcpy(J40__F32_PIXELS(&smoothed[c], ggh8 - 1), J40__F32_PIXELS(&lfquant[c], ggh8 - 1),
+			sizeof(float) * (size_t) ggw8);
 	}
 
 	for (y = 1; y < ggh8 - 1; ++y) {
-		float *outline[3], *sline[3];
+		const float *nline[3], *line[3], *sline[3];
+		float *outline[3];
 		for (c = 0; c < 3; ++c) {
-			float *temp = nline[c];
-			nline[c] = line[c];
-			line[c] = temp;
-			outline[c] = J40__F32_PIXELS(&lfquant[c], y);
+			nline[c] = J40__F32_PIXELS(&lfquant[c], y - 1);
+			line[c] = J40__F32_PIXELS(&lfquant[c], y);
 			sline[c] = J40__F32_PIXELS(&lfquant[c], y + 1);
-			memcpy(line[c], outline[c], sizeof(float) * (size_t) ggw8);
-		}
-		for (x = 1; x < ggw8 - 1; ++x) {
-			float wa[3], diff[3], gap = 0.5f;
+			outline[c] = J40__F32_PIXELS(&smoothed[c], y);
+			outline[c][0] = line[c][0];
+			outline[c][ggw8 - 1] = line[c][ggw8 - 1];
+		}
+		for (x = 1; x < ggw8 - 1; x += J40__SMOOTH_LF_LANES) {
+			int32_t n = j40__min32(J40__SMOOTH_LF_LANES, ggw8 - 1 - x);
+			float wa[3][J40__SMOOTH_LF_LANES], gap[J40__SMOOTH_LF_LANES];
+			for (i = 0; i < n; ++i) gap[i] = 0.5f;
+			for (c = 0; c < 3; ++c) {
+				const float *J40_RESTRICT np = nline[c] + x, *J40_RESTRICT p = line[c] + x, *J40_RESTRICT sp = sline[c] + x;
+				float *J40_RESTRICT w = wa[c], inv = inv_m_lf[c];
+				for (i = 0; i < n; ++i) {
+					float v =
+						(np[i - 1] * W2 + np[i] * W1 + np[i + 1] * W2) +
+						( p[i - 1] * W1 +  p[i] * W0 +  p[i + 1] * W1) +
+						(sp[i - 1] * W2 + sp[i] * W1 + sp[i + 1] * W2);
+					w[i] = v;
+					gap[i] = j40__maxf(gap[i], fabsf(v - p[i]) * inv);
+				}
+			}
+			for (i = 0; i < n; ++i) gap[i] = j40__maxf(0.0f, 3.0f - 4.0f * gap[i]);
 			for (c = 0; c < 3; ++c) {
-				wa[c] =
-					(nline[c][x - 1] * W2 + nline[c][x] * W1 + nline[c][x + 1] * W2) +
-					( line[c][x - 1] * W1 +  line[c][x] * W0 +  line[c][x + 1] * W1) +
-					(sline[c][x - 1] * W2 + sline[c][x] * W1 + sline[c][x + 1] * W2);
-				diff[c] = fabsf(wa[c] - line[c][x]) * inv_m_lf[c];
-				if (gap < diff[c]) gap = diff[c];
+				const float *J40_RESTRICT p = line[c] + x, *J40_RESTRICT w = wa[c];
+				float *J40_RESTRICT out = outline[c] + x;
+				// TODO spec bug: s (sample) and wa (weighted average) are swapped in the final formula
+				for (i = 0; i < n; ++i) out[i] = (w[i] - p[i]) * gap[i] + p[i];
 			}
-			gap = j40__maxf(0.0f, 3.0f - 4.0f * gap);
-			// TODO spec bug: s (sample) and wa (weighted average) are swapped in the final formula
-			for (c = 0; c < 3; ++c) outline[c][x] = (wa[c] - line[c][x]) * gap + line[c][x];
 		}
 	}
 
+	for (c = 0; c < 3; ++c) {
+		j40__release_plane(st->pool, &lfquant[c]);
+		lfquant[c] = smoothed[c];
+	}
+	return 0;
+
 J40__ON_ERROR:
-	j40__free(linebuf);
+	for (c = 0; c < 3; ++c) j40__release_plane(st->pool, &smoothed[c]);
 	return st->err;
+
+	#undef J40__SMOOTH_LF_LANES
 }
 
 J40__STATIC_RETURNS_ERR j40__lf_quant(
@@ -6577,8 +7226,8 @@ J40__STATIC_RETURNS_ERR j40__lf_quant(
 	return 0;
 
 J40__ON_ERROR:
-	for (c = 0; c < 3; ++c) j40__free_plane(&lfquant[c]);
-	j40__free_plane(&lfindices);
+	for (c = 0; c < 3; ++c) j40__release_plane(st->pool, &lfquant[c]);
+	j40__release_plane(st->pool, &lfindices);
 	return st->err;
 }
 
@@ -6589,8 +7238,7 @@ J40__STATIC_RETURNS_ERR j40__hf_metadata(
 	j40__frame_st *f = st->frame;
 	j40__plane blocks = J40__INIT;
 	j40__varblock *varblocks = NULL;
-	float *coeffs[3 /*xyb*/] = {NULL}, *llfcoeffs[3 /*xyb*/] = {NULL};
-	size_t coeffs_misalign[3] = {0};
+	float *llfcoeffs[3 /*xyb*/] = {NULL};
 	int32_t log_gsize8 = f->group_size_shift - 3;
 	int32_t ggw8 = gg->width8, ggh8 = gg->height8;
 	int32_t voff, coeffoff;
@@ -6607,11 +7255,6 @@ J40__STATIC_RETURNS_ERR j40__hf_metadata(
 	J40__TRY_MALLOC(j40__varblock, &varblocks, (size_t) nb_varblocks);
 	for (c = 0; c < 3; ++c) { // TODO account for chroma subsampling
 		J40__TRY_MALLOC(float, &llfcoeffs[c], (size_t) (ggw8 * ggh8));
-		J40__SHOULD(
-			coeffs[c] = (float*) j40__alloc_aligned(
-				sizeof(float) * (size_t) (ggw8 * ggh8 * 64), J40__COEFFS_ALIGN, &coeffs_misalign[c]),
-			"!mem");
-		for (i = 0; i < ggw8 * ggh8 * 64; ++i) coeffs[c][i] = 0.0f;
 	}
 
 	// temporarily use coeffoff_qfidx to store DctSelect
@@ -6702,20 +7345,27 @@ J40__STATIC_RETURNS_ERR j40__hf_metadata(
 	gg->nb_varblocks = nb_varblocks;
 	gg->blocks = blocks;
 	gg->varblocks = varblocks;
-	for (c = 0; c < 3; ++c) {
-		gg->llfcoeffs[c] = llfcoeffs[c];
-		gg->coeffs[c] = coeffs[c];
-		gg->coeffs_misalign[c] = (uint8_t) coeffs_misalign[c];
-	}
+	for (c = 0; c < 3; ++c) gg->llfcoeffs[c] = llfcoeffs[c];
 	return 0;
 
 J40__ON_ERROR:
 	j40__free_plane(&blocks);
 	j40__free(varblocks);
-	for (c = 0; c < 3; ++c) {
-		j40__free_aligned(coeffs[c], J40__COEFFS_ALIGN, coeffs_misalign[c]);
-		j40__free(llfcoeffs[c]);
-	}
+	for (c = 0; c < 3; ++c) j40__free(llfcoeffs[c]);
+	return st->err;
+}
+
+// HF coefficients are allocated only when the first pass group for this LF group is about to be read.
+// this keeps the memory usage low when LF groups are finished and released progressively.
+J40__STATIC_RETURNS_ERR j40__allocate_coeffs(j40__st *st, j40__lf_group_st *gg) {
+	int32_t i;
+
+	if (gg->hf_heads) return 0; // already allocated
+
+	J40__TRY_MALLOC(int32_t, &gg->hf_heads, (size_t) gg->nb_varblocks * 3);
+	for (i = 0; i < gg->nb_varblocks * 3; ++i) gg->hf_heads[i] = -1;
+
+J40__ON_ERROR:
 	return st->err;
 }
 
@@ -6758,7 +7408,7 @@ J40__STATIC_RETURNS_ERR j40__lf_group(j40__st *st, j40__lf_group_st *gg) {
 			// TODO spec issue: this modular image is independent of bpp/float_sample/etc.
 			// TODO spec bug: channels are in the YXB order
 			J40__TRY(j40__lf_quant(st, extra_prec, &m, gg, lfquant));
-			j40__free_modular(&m);
+			j40__release_modular(st->pool, &m);
 		} else {
 			J40__RAISE("TODO: persist lfquant and use it in later frames");
 		}
@@ -6776,32 +7426,72 @@ J40__STATIC_RETURNS_ERR j40__lf_group(j40__st *st, j40__lf_group_st *gg) {
 		J40__TRY(j40__finish_and_free_code(st, &m.code));
 		J40__TRY(j40__inverse_transform(st, &m));
 		J40__TRY(j40__hf_metadata(st, nb_varblocks, &m, lfquant, gg));
-		j40__free_modular(&m);
-		for (i = 0; i < 3; ++i) j40__free_plane(&lfquant[i]);
+		j40__release_modular(st->pool, &m);
+		if (f->keep_lf) {
+			for (i = 0; i < 3; ++i) {
+				gg->lfquant[i] = lfquant[i];
+				lfquant[i].type = 0;
+			}
+		}
+		for (i = 0; i < 3; ++i) j40__release_plane(st->pool, &lfquant[i]);
 	}
 
 	return 0;
 
 J40__ON_ERROR:
-	j40__free_modular(&m);
-	for (i = 0; i < 3; ++i) j40__free_plane(&lfquant[i]);
+	j40__release_modular(st->pool, &m);
+	for (i = 0; i < 3; ++i) j40__release_plane(st->pool, &lfquant[i]);
 	if (gg) j40__free_lf_group(gg);
 	return st->err;
 }
 
+// returns false if the group `gidx` doesn't contribute to the requested region (see j40_output_region),
+// either because it's outside of the region or it has been fetched from the tile cache already.
+// modular frames always need all groups, as they are only complete after the global inverse transform.
+J40_INLINE int j40__group_in_region(const j40__frame_st *f, int64_t gidx) {
+	int32_t gsize = 1 << f->group_size_shift;
+	int64_t x, y;
+	if (!f->region_x1 || f->is_modular) return 1;
+	if (f->tile_cached && f->tile_cached[gidx]) return 0;
+	x = (gidx % f->gcolumns) << f->group_size_shift;
+	y = (gidx / f->gcolumns) << f->group_size_shift;
+	return x < f->region_x1 && f->region_x0 < x + gsize && y < f->region_y1 && f->region_y0 < y + gsize;
+}
+
+// returns false if `gg` can be skipped entirely for the requested region, i.e. no contained group is needed
+J40_INLINE int j40__lf_group_in_region(const j40__frame_st *f, const j40__lf_group_st *gg) {
+	int64_t x, y;
+	if (!f->region_x1 || f->is_modular) return 1;
+	if (!(gg->left < f->region_x1 && f->region_x0 < gg->left + gg->width &&
+		gg->top < f->region_y1 && f->region_y0 < gg->top + gg->height)) return 0;
+	if (!f->tile_cached) return 1;
+	for (y = 0; y < gg->grows; ++y) {
+		for (x = 0; x < gg->gcolumns; ++x) {
+			if (j40__group_in_region(f, gg->gidx + gg->gstride * y + x)) return 1;
+		}
+	}
+	return 0;
+}
+
 J40_STATIC void j40__free_lf_group(j40__lf_group_st *gg) {
 	int32_t i;
 	for (i = 0; i < 3; ++i) {
 		j40__free(gg->llfcoeffs[i]);
-		j40__free_aligned(gg->coeffs[i], J40__COEFFS_ALIGN, gg->coeffs_misalign[i]);
 		gg->llfcoeffs[i] = NULL;
-		gg->coeffs[i] = NULL;
 	}
+	j40__free(gg->hf_heads);
+	j40__free(gg->hf_runs);
+	j40__free(gg->hf_coeffs);
+	gg->hf_heads = NULL;
+	gg->hf_runs = NULL;
+	gg->hf_coeffs = NULL;
+	gg->num_hf_runs = gg->hf_runs_cap = gg->num_hf_coeffs = gg->hf_coeffs_cap = 0;
 	j40__free_plane(&gg->xfromy);
 	j40__free_plane(&gg->bfromy);
 	j40__free_plane(&gg->sharpness);
 	j40__free_plane(&gg->blocks);
 	j40__free_plane(&gg->lfindices);
+	for (i = 0; i < 3; ++i) j40__free_plane(&gg->lfquant[i]);
 	j40__free(gg->varblocks);
 	gg->varblocks = NULL;
 }
@@ -6815,6 +7505,31 @@ J40__STATIC_RETURNS_ERR j40__hf_global(j40__st *st);
 
 #ifdef J40_IMPLEMENTATION
 
+// 2 * (CoeffNumNonzeroContext + CoeffFreqContext) indexed by
+// (CeilDiv(nonzeros, size/64) << 6 | coefficient index / (size/64)). both context components only
+// depend on the two buckets, so the coefficient loop can find the sum with a single load instead of
+// a division and two lookups per coefficient. each row is CoeffFreqContext (pre-multiplied by 2,
+// [0] is unused) offset by 2 * CoeffNumNonzeroContext of that row.
+#define J40__COEFF_CTX_ROW(n) \
+	n-1, n+ 0, n+ 2, n+ 4, n+ 6, n+ 8, n+10, n+12, n+14, n+16, n+18, n+20, n+22, n+24, n+26, n+28, \
+	n+30, n+30, n+32, n+32, n+34, n+34, n+36, n+36, n+38, n+38, n+40, n+40, n+42, n+42, n+44, n+44, \
+	n+46, n+46, n+46, n+46, n+48, n+48, n+48, n+48, n+50, n+50, n+50, n+50, n+52, n+52, n+52, n+52, \
+	n+54, n+54, n+54, n+54, n+56, n+56, n+56, n+56, n+58, n+58, n+58, n+58, n+60, n+60, n+60, n+60
+// TODO spec bug: CoeffNumNonzeroContext[9] should be 123, not 23
+J40_STATIC const int16_t J40__COEFF_CTX[64 * 64] = {
+#define J40__R J40__COEFF_CTX_ROW
+	J40__R(  0), J40__R(  0), J40__R( 62), J40__R(124), J40__R(124), J40__R(186), J40__R(186), J40__R(186),
+	J40__R(186), J40__R(246), J40__R(246), J40__R(246), J40__R(246), J40__R(304), J40__R(304), J40__R(304),
+	J40__R(304), J40__R(304), J40__R(304), J40__R(304), J40__R(304), J40__R(360), J40__R(360), J40__R(360),
+	J40__R(360), J40__R(360), J40__R(360), J40__R(360), J40__R(360), J40__R(360), J40__R(360), J40__R(360),
+	J40__R(360), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412),
+	J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412),
+	J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412),
+	J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412), J40__R(412),
+#undef J40__R
+};
+#undef J40__COEFF_CTX_ROW
+
 // reads both HfGlobal and HfPass (SPEC they form a single group)
 J40__STATIC_RETURNS_ERR j40__hf_global(j40__st *st) {
 	j40__frame_st *f = st->frame;
@@ -6891,6 +7606,7 @@ J40__STATIC_RETURNS_ERR j40__hf_coeffs(
 ) {
 	typedef int8_t j40_i8x3[3];
 	const j40__frame_st *f = st->frame;
+	const int16_t *coeff_ctx = J40__COEFF_CTX;
 	int32_t gw8 = j40__ceil_div32(gw, 8), gh8 = j40__ceil_div32(gh, 8);
 	int8_t (*nonzeros)[3] = NULL;
 	j40__code_st code = J40__INIT;
@@ -6909,8 +7625,8 @@ J40__STATIC_RETURNS_ERR j40__hf_coeffs(
 		// TODO spec issue: missing x and y (here called x8 and y8)
 		int32_t ggx8 = x8 + gx_in_gg / 8, ggy8 = y8 + gy_in_gg / 8, nzpos = y8 * gw8 + x8;
 		int32_t voff = J40__I32_PIXELS(&gg->blocks, ggy8)[ggx8], dctsel = voff >> 20;
-		int32_t log_rows, log_columns, log_size;
-		int32_t coeffoff, qfidx, lfidx, bctx0, bctxc;
+		int32_t log_rows, log_columns, log_size, bucket_shift, bucket_round;
+		int32_t qfidx, lfidx, bctx0, bctxc;
 
 		if (dctsel < 2) continue; // not top-left block
 		dctsel -= 2;
@@ -6920,8 +7636,9 @@ J40__STATIC_RETURNS_ERR j40__hf_coeffs(
 		log_rows = dct->log_rows;
 		log_columns = dct->log_columns;
 		log_size = log_rows + log_columns;
+		bucket_shift = log_size - 6;
+		bucket_round = (1 << bucket_shift) - 1;
 
-		coeffoff = gg->varblocks[voff].coeffoff_qfidx & ~15;
 		qfidx = gg->varblocks[voff].coeffoff_qfidx & 15;
 		// TODO spec improvement: explain why lf_idx is separately calculated
 		// (answer: can be efficiently precomputed via vectorization)
@@ -6932,25 +7649,10 @@ J40__STATIC_RETURNS_ERR j40__hf_coeffs(
 		// unlike most places, this uses the YXB order
 		for (c_yxb = 0; c_yxb < 3; ++c_yxb) {
 			static const int32_t YXB2XYB[3] = {1, 0, 2};
-			static const int8_t TWICE_COEFF_FREQ_CTX[64] = { // pre-multiplied by 2, [0] is unused
-				-1,  0,  2,  4,  6,  8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28,
-				30, 30, 32, 32, 34, 34, 36, 36, 38, 38, 40, 40, 42, 42, 44, 44,
-				46, 46, 46, 46, 48, 48, 48, 48, 50, 50, 50, 50, 52, 52, 52, 52,
-				54, 54, 54, 54, 56, 56, 56, 56, 58, 58, 58, 58, 60, 60, 60, 60,
-			};
-			// TODO spec bug: CoeffNumNonzeroContext[9] should be 123, not 23
-			static const int16_t TWICE_COEFF_NNZ_CTX[64] = { // pre-multiplied by 2
-				  0,   0,  62, 124, 124, 186, 186, 186, 186, 246, 246, 246, 246, 304, 304, 304,
-				304, 304, 304, 304, 304, 360, 360, 360, 360, 360, 360, 360, 360, 360, 360, 360,
-				360, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412,
-				412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412, 412,
-			};
-
 			int32_t c = YXB2XYB[c_yxb];
-			float *coeffs = gg->coeffs[c] + coeffoff;
 			int32_t *order = f->orders[pass][dct->order_idx][c];
 			int32_t bctx = f->block_ctx_map[bctx0 + bctxc * c_yxb]; // BlockContext()
-			int32_t nz, nzctx, cctx, qnz, prev;
+			int32_t nz, nzctx, cctx, qnz, prev, start = gg->num_hf_coeffs;
 
 			// orders should have been already converted from Lehmer code
 			J40__ASSERT(order && ((f->order_loaded >> dct->order_idx) & 1));
@@ -6968,29 +7670,40 @@ J40__STATIC_RETURNS_ERR j40__hf_coeffs(
 			// TODO spec issue: missing
 			J40__SHOULD(nz <= (63 << (log_size - 6)), "coef");
 
-			qnz = j40__ceil_div32(nz, 1 << (log_size - 6)); // [0, 64)
+			qnz = (nz + bucket_round) >> bucket_shift; // CeilDiv(nz, size/64) in [0, 64)
 			for (i = 0; i < (1 << (log_rows - 3)); ++i) {
 				for (j = 0; j < (1 << (log_columns - 3)); ++j) {
 					nonzeros[nzpos + i * gw8 + j][c] = (int8_t) qnz;
 				}
 			}
 			cctx = ctxoff + 458 * bctx + 37 * f->nb_block_ctx;
+			J40__TRY_REALLOC32(j40__hf_coeff, &gg->hf_coeffs, start + nz, &gg->hf_coeffs_cap);
 
 			prev = (nz <= (1 << (log_size - 4))); // TODO spec bug: swapped condition
 			// TODO spec issue: missing size (probably W*H)
-			for (i = 1 << (log_size - 6); nz > 0 && i < (1 << log_size); ++i) {
-				int32_t ctx = cctx +
-					TWICE_COEFF_NNZ_CTX[j40__ceil_div32(nz, 1 << (log_size - 6))] +
-					TWICE_COEFF_FREQ_CTX[i >> (log_size - 6)] + prev;
+			for (i = 1 << bucket_shift; nz > 0 && i < (1 << log_size); ++i) {
+				int32_t ctx = cctx + coeff_ctx[((nz + bucket_round) >> bucket_shift) << 6 | i >> bucket_shift] + prev;
 				// TODO spec question: can this overflow?
 				// unlike modular there is no guarantee about "buffers" or anything similar here
 				int32_t ucoeff = j40__code(st, ctx, 0, &code);
-				// TODO int-to-float conversion, is it okay?
-				coeffs[order[i]] += (float) j40__unpack_signed(ucoeff);
+				if (ucoeff) {
+					gg->hf_coeffs[gg->num_hf_coeffs].pos = order[i];
+					gg->hf_coeffs[gg->num_hf_coeffs].value = j40__unpack_signed(ucoeff);
+					++gg->num_hf_coeffs;
+				}
 				// TODO spec issue: normative indicator has changed from [[...]] to a long comment
 				nz -= prev = (ucoeff != 0);
 			}
 			J40__SHOULD(nz == 0, "coef"); // TODO spec issue: missing
+
+			if (gg->num_hf_coeffs > start) {
+				int32_t *head = &gg->hf_heads[voff * 3 + c];
+				J40__TRY_REALLOC32(j40__hf_run, &gg->hf_runs, gg->num_hf_runs + 1, &gg->hf_runs_cap);
+				gg->hf_runs[gg->num_hf_runs].next = *head;
+				gg->hf_runs[gg->num_hf_runs].start = start;
+				gg->hf_runs[gg->num_hf_runs].count = gg->num_hf_coeffs - start;
+				*head = gg->num_hf_runs++;
+			}
 		}
 	}
 
@@ -7018,6 +7731,7 @@ J40__STATIC_RETURNS_ERR j40__pass_group(
 		int32_t ctxoff;
 		// TODO spec issue: this offset is later referred so should be monospaced
 		ctxoff = 495 * f->nb_block_ctx * j40__u(st, j40__ceil_lg32((uint32_t) f->num_hf_presets));
+		J40__TRY(j40__allocate_coeffs(st, gg));
 		J40__TRY(j40__hf_coeffs(st, ctxoff, pass, gx_in_gg, gy_in_gg, gw, gh, gg));
 	}
 
@@ -7030,13 +7744,13 @@ J40__STATIC_RETURNS_ERR j40__pass_group(
 		J40__TRY(j40__inverse_transform(st, &m));
 		j40__combine_modular_from_pass_group(f->num_gm_channels,
 			gg->top + gy_in_gg, gg->left + gx_in_gg, 0, 3, &f->gmodular, &m);
-		j40__free_modular(&m);
+		j40__release_modular(st->pool, &m);
 	}
 
 	return 0;
 
 J40__ON_ERROR:
-	j40__free_modular(&m);
+	j40__release_modular(st->pool, &m);
 	return st->err;
 }
 
@@ -7045,72 +7759,97 @@ J40__ON_ERROR:
 ////////////////////////////////////////////////////////////////////////////////
 // coefficients to samples
 
-J40_STATIC void j40__dequant_hf(j40__st *st, j40__lf_group_st *gg);
-J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40__lf_group_st *gg);
+J40_STATIC int j40__expand_hf(
+	j40__st *st, const j40__lf_group_st *gg, int32_t voff, const j40__dct_select *dct, int32_t c, float *out
+);
+J40_ALWAYS_INLINE float j40__srgb_transfer(float v, const float *lut);
+J40__STATIC_RETURNS_ERR j40__prepare_transfer(j40__st *st);
+J40__STATIC_RETURNS_ERR j40__xyb_to_srgb(
+	j40__st *st, float *samples[3], int32_t width, int32_t height, j40__plane *out, int32_t left, int32_t top
+);
+J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(
+	j40__st *st, const j40__lf_group_st *gg, j40__plane *out, int32_t outleft, int32_t outtop
+);
+J40__STATIC_RETURNS_ERR j40__lf_image_from_lf_group(j40__st *st, const j40__lf_group_st *gg, j40__plane out[3]);
 
 #ifdef J40_IMPLEMENTATION
 
-J40_STATIC void j40__dequant_hf(j40__st *st, j40__lf_group_st *gg) {
+// expands HF coefficients for the channel `c` of the varblock `voff` into `out` and dequantizes them.
+// returns false if the channel has no nonzero HF coefficients, in which case `out` is simply zeroed.
+J40_STATIC int j40__expand_hf(
+	j40__st *st, const j40__lf_group_st *gg, int32_t voff, const j40__dct_select *dct, int32_t c, float *out
+) {
 	// QM_SCALE[i] = 0.8^(i - 2)
 	static const float QM_SCALE[8] = {1.5625f, 1.25f, 1.0f, 0.8f, 0.64f, 0.512f, 0.4096f, 0.32768f};
 
 	j40__frame_st *f = st->frame;
-	int32_t ggw8 = gg->width8, ggh8 = gg->height8;
-	float x_qm_scale, b_qm_scale, quant_bias_num = st->image->quant_bias_num, *quant_bias = st->image->quant_bias;
-	int32_t x8, y8, c, i;
+	float quant_bias = st->image->quant_bias[c], quant_bias_num = st->image->quant_bias_num, mult;
+	const j40__dq_matrix *dqmat = &f->dq_matrix[dct->param_idx];
+	int32_t size = 1 << (dct->log_rows + dct->log_columns), head, i;
+	const j40__hf_run *run;
+
+	for (i = 0; i < size; ++i) out[i] = 0.0f;
+	head = gg->hf_heads ? gg->hf_heads[voff * 3 + c] : -1;
+	if (head < 0) return 0;
 
 	J40__ASSERT(f->x_qm_scale >= 0 && f->x_qm_scale < 8);
 	J40__ASSERT(f->b_qm_scale >= 0 && f->b_qm_scale < 8);
-	x_qm_scale = QM_SCALE[f->x_qm_scale];
-	b_qm_scale = QM_SCALE[f->b_qm_scale];
-
-	for (y8 = 0; y8 < ggh8; ++y8) for (x8 = 0; x8 < ggw8; ++x8) {
-		const j40__dct_select *dct;
-		const j40__dq_matrix *dqmat;
-		int32_t voff = J40__I32_PIXELS(&gg->blocks, y8)[x8], dctsel = voff >> 20, size;
-		float mult[3 /*xyb*/];
-
-		if (dctsel < 2) continue; // not top-left block
-		voff &= 0xfffff;
-		dct = &J40__DCT_SELECT[dctsel - 2];
-		size = 1 << (dct->log_rows + dct->log_columns);
-		// TODO spec bug: spec says mult[1] = HfMul, should be 2^16 / (global_scale * HfMul)
-		mult[1] = 65536.0f / (float) f->global_scale * gg->varblocks[voff].hfmul.inv;
-		mult[0] = mult[1] * x_qm_scale;
-		mult[2] = mult[1] * b_qm_scale;
-		dqmat = &f->dq_matrix[dct->param_idx];
-		J40__ASSERT(dqmat->mode == J40__DQ_ENC_RAW); // should have been already loaded
+	J40__ASSERT(dqmat->mode == J40__DQ_ENC_RAW); // should have been already loaded
+	// TODO spec bug: spec says mult[1] = HfMul, should be 2^16 / (global_scale * HfMul)
+	mult = 65536.0f / (float) f->global_scale * gg->varblocks[voff].hfmul.inv;
+	if (c == 0) mult *= QM_SCALE[f->x_qm_scale];
+	if (c == 2) mult *= QM_SCALE[f->b_qm_scale];
+
+	#define J40__DEQUANT_HF(v, pos) do { \
+		/* TODO spec issue: "quant" is a variable name and should be monospaced */ \
+		if (-1.0f <= (v) && (v) <= 1.0f) (v) *= quant_bias; else (v) -= quant_bias_num / (v); \
+		(v) *= mult / dqmat->params[pos][c]; /* TODO precompute this */ \
+	} while (0)
 
-		for (c = 0; c < 3; ++c) {
-			float *coeffs = gg->coeffs[c] + (gg->varblocks[voff].coeffoff_qfidx & ~15);
-			for (i = 0; i < size; ++i) { // LLF positions are left unused and can be clobbered
-				// TODO spec issue: "quant" is a variable name and should be monospaced
-				if (-1.0f <= coeffs[i] && coeffs[i] <= 1.0f) {
-					coeffs[i] *= quant_bias[c]; // TODO coeffs[i] is integer at this point?
-				} else {
-					coeffs[i] -= quant_bias_num / coeffs[i];
-				}
-				coeffs[i] *= mult[c] / dqmat->params[i][c]; // TODO precompute this
+	run = &gg->hf_runs[head];
+	if (run->next < 0) { // only a single pass has nonzero coefficients, so positions are distinct
+		for (i = run->start; i < run->start + run->count; ++i) {
+			const j40__hf_coeff *coeff = &gg->hf_coeffs[i];
+			float v = (float) coeff->value;
+			J40__DEQUANT_HF(v, coeff->pos);
+			out[coeff->pos] = v;
+		}
+	} else { // coefficients from multiple passes should be summed before the (non-linear) dequantization
+		for (; head >= 0; head = run->next) {
+			run = &gg->hf_runs[head];
+			for (i = run->start; i < run->start + run->count; ++i) {
+				out[gg->hf_coeffs[i].pos] += (float) gg->hf_coeffs[i].value;
 			}
 		}
+		for (i = 0; i < size; ++i) J40__DEQUANT_HF(out[i], i); // LLF positions can be clobbered
 	}
+
+	#undef J40__DEQUANT_HF
+	return 1;
 }
 
-J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40__lf_group_st *gg) {
+// writes samples to the rectangle starting from (`outleft`, `outtop`) in `out` (see j40__xyb_to_srgb)
+J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(
+	j40__st *st, const j40__lf_group_st *gg, j40__plane *out, int32_t outleft, int32_t outtop
+) {
 	j40__image_st *im = st->image;
 	j40__frame_st *f = st->frame;
 	int32_t ggw8 = gg->width8, ggh8 = gg->height8;
 	int32_t ggw = gg->width, ggh = gg->height;
-	float kx_lf, kb_lf, cbrt_opsin_bias[3 /*xyb*/];
-	float *scratch = NULL, *scratch2, *samples[3] = {0};
+	float kx_lf, kb_lf;
+	float *scratch = NULL, *scratch2, *ycoeffs, *samples[3] = {0};
 	int32_t x8, y8, x, y, i, c;
 
+	J40__SHOULD(!f->do_ycbcr && im->cspace != J40__CS_GREY, "TODO: we don't yet do YCbCr or gray");
+	J40__SHOULD(im->modular_16bit_buffers, "TODO: !modular_16bit_buffers");
+
 	for (c = 0; c < 3; ++c) {
 		J40__TRY_MALLOC(float, &samples[c], (size_t) (ggw * ggh));
 	}
 	// TODO allocates the same amount of memory regardless of transformations used
-	J40__TRY_MALLOC(float, &scratch, 2 * 65536);
+	J40__TRY_MALLOC(float, &scratch, 3 * 65536);
 	scratch2 = scratch + 65536;
+	ycoeffs = scratch + 2 * 65536; // dequantized Y coefficients, needed for chroma from luma
 
 	kx_lf = f->base_corr_x + (float) f->x_factor_lf * f->inv_colour_factor;
 	kb_lf = f->base_corr_b + (float) f->b_factor_lf * f->inv_colour_factor;
@@ -7118,9 +7857,9 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 	for (y8 = 0; y8 < ggh8; ++y8) for (x8 = 0; x8 < ggw8; ++x8) {
 		const j40__dct_select *dct;
 		int32_t voff = J40__I32_PIXELS(&gg->blocks, y8)[x8], dctsel = voff >> 20;
-		int32_t size, effvw, effvh, vw8, vh8, samplepos;
+		int32_t size, effvw, effvh, vw8, vh8, samplepos, has_y, has_hf;
 		int32_t coeffoff;
-		float *coeffs[3 /*xyb*/], *llfcoeffs[3 /*xyb*/], kx_hf, kb_hf;
+		float *llfcoeffs[3 /*xyb*/], kx_hf, kb_hf;
 
 		if (dctsel < 2) continue; // not top-left block
 		dctsel -= 2;
@@ -7128,10 +7867,8 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 		dct = &J40__DCT_SELECT[dctsel];
 		size = 1 << (dct->log_rows + dct->log_columns);
 		coeffoff = gg->varblocks[voff].coeffoff_qfidx & ~15;
-		for (c = 0; c < 3; ++c) {
-			coeffs[c] = gg->coeffs[c] + coeffoff;
-			llfcoeffs[c] = gg->llfcoeffs[c] + (coeffoff >> 6);
-		}
+		for (c = 0; c < 3; ++c) llfcoeffs[c] = gg->llfcoeffs[c] + (coeffoff >> 6);
+		has_y = j40__expand_hf(st, gg, voff, dct, 1, ycoeffs);
 
 		// TODO spec bug: x_factor and b_factor (for HF) is constant in the same varblock,
 		// even when the varblock spans multiple 64x64 rectangles
@@ -7154,19 +7891,22 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 			// TODO skip CfL if there's subsampled channel
 			switch (c) {
 			case 0: // X
-				for (i = 0; i < size; ++i) scratch[i] = coeffs[0][i] + coeffs[1][i] * kx_hf;
+				has_hf = j40__expand_hf(st, gg, voff, dct, 0, scratch) | has_y;
+				if (has_y) for (i = 0; i < size; ++i) scratch[i] += ycoeffs[i] * kx_hf;
 				for (y = 0; y < vh8; ++y) for (x = 0; x < vw8; ++x) {
 					scratch[y * vw8 * 8 + x] = llfcoeffs[0][y * vw8 + x] + llfcoeffs[1][y * vw8 + x] * kx_lf;
 				}
 				break;
 			case 1: // Y
-				for (i = 0; i < size; ++i) scratch[i] = coeffs[1][i];
+				memcpy(scratch, ycoeffs, sizeof(float) * (size_t) size);
+				has_hf = has_y;
 				for (y = 0; y < vh8; ++y) for (x = 0; x < vw8; ++x) {
 					scratch[y * vw8 * 8 + x] = llfcoeffs[1][y * vw8 + x];
 				}
 				break;
 			case 2: // B
-				for (i = 0; i < size; ++i) scratch[i] = coeffs[2][i] + coeffs[1][i] * kb_hf;
+				has_hf = j40__expand_hf(st, gg, voff, dct, 2, scratch) | has_y;
+				if (has_y) for (i = 0; i < size; ++i) scratch[i] += ycoeffs[i] * kb_hf;
 				for (y = 0; y < vh8; ++y) for (x = 0; x < vw8; ++x) {
 					scratch[y * vw8 * 8 + x] = llfcoeffs[2][y * vw8 + x] + llfcoeffs[1][y * vw8 + x] * kb_lf;
 				}
@@ -7186,7 +7926,11 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 			case 16: j40__inverse_afv(scratch, 0, 1); break; // AFV2
 			case 17: j40__inverse_afv(scratch, 1, 1); break; // AFV3
 			default: // every other DCTnm where n, m >= 3
-				j40__inverse_dct2d(scratch, scratch2, dct->log_rows, dct->log_columns);
+				if (has_hf) {
+					j40__inverse_dct2d(scratch, scratch2, dct->log_rows, dct->log_columns);
+				} else { // common in flat areas
+					j40__inverse_dct2d_llf(scratch, scratch2, dct->log_rows, dct->log_columns);
+				}
 				break;
 			}
 
@@ -7204,10 +7948,70 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 	}
 
 	// coeffs is now correctly positioned, copy to the modular buffer
-	// TODO this is highly ad hoc, should be moved to rendering
+	J40__TRY(j40__xyb_to_srgb(st, samples, ggw, ggh, out, outleft, outtop));
+
+J40__ON_ERROR:
+	j40__free(scratch);
+	for (c = 0; c < 3; ++c) j40__free(samples[c]);
+	return st->err;
+}
+
+#define J40__SRGB_LUT_BITS 12
+#define J40__FIXED_LINEAR_BITS 14
+
+// the sRGB transfer function; `lut` (if given) has `(1 << J40__SRGB_LUT_BITS) + 1` samples of
+// the nonlinear part over [0, 1] and is linearly interpolated (see J40_APPROX_TRANSFER)
+J40_ALWAYS_INLINE float j40__srgb_transfer(float v, const float *lut) {
+	// TODO very, very slow; probably different approximations per bpp ranges may be needed
+	if (v <= 0.0031308f) return 12.92f * v;
+	if (lut && v < 1.0f) {
+		float t = v * (float) (1 << J40__SRGB_LUT_BITS);
+		int32_t i = (int32_t) t;
+		return lut[i] + (lut[i + 1] - lut[i]) * (t - (float) i);
+	}
+	return 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// builds transfer tables for the current output options, only once per decoder (see j40__plan_output)
+J40__STATIC_RETURNS_ERR j40__prepare_transfer(j40__st *st) {
+	j40__frame_st *f = st->frame;
+	int32_t x;
+
+	if (f->fixed_point && st->image->bpp == 8 && !f->transfer_lut8) {
+		// linear [0, 1] in 14-bit fixed point -> final 8-bit level, covering both segments
+		J40__TRY_MALLOC(uint8_t, &f->transfer_lut8, (1 << J40__FIXED_LINEAR_BITS) + 1);
+		for (x = 0; x <= 1 << J40__FIXED_LINEAR_BITS; ++x) {
+			float v = j40__srgb_transfer((float) x / (float) (1 << J40__FIXED_LINEAR_BITS), NULL);
+			f->transfer_lut8[x] = (uint8_t) (255.0f * v + 0.5f);
+		}
+	} else if (f->approx_transfer && !f->transfer_lut) { // only covers the nonlinear part in [0.0031308, 1]
+		J40__TRY_MALLOC(float, &f->transfer_lut, (1 << J40__SRGB_LUT_BITS) + 1);
+		for (x = 0; x <= 1 << J40__SRGB_LUT_BITS; ++x) {
+			f->transfer_lut[x] = 1.055f * powf((float) x / (float) (1 << J40__SRGB_LUT_BITS), 1.0f / 2.4f) - 0.055f;
+		}
+	}
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// converts XYB `samples` (`width` x `height` each, destroyed) into rows starting from (left, top) of `out`.
+// `out` is either three I16 planes of the image bit depth, or a single U8 plane of interleaved RGBA
+// samples (in `out[0]`, alpha being always opaque) which gets 8-bit levels directly from float samples.
+// TODO this is highly ad hoc, should be moved to rendering
+J40__STATIC_RETURNS_ERR j40__xyb_to_srgb(
+	j40__st *st, float *samples[3], int32_t width, int32_t height, j40__plane *out, int32_t left, int32_t top
+) {
+	j40__image_st *im = st->image;
+	float cbrt_opsin_bias[3 /*xyb*/];
+	const float *lut = st->frame->transfer_lut; // see j40__prepare_transfer
+	const uint8_t *lut8 = st->frame->transfer_lut8;
+	int fixed = lut8 != NULL;
+	int32_t x, y, c;
+
 	for (c = 0; c < 3; ++c) cbrt_opsin_bias[c] = cbrtf(im->opsin_bias[c]);
-	for (y = 0; y < ggh; ++y) for (x = 0; x < ggw; ++x) {
-		int32_t pos = y * ggw + x;
+	for (y = 0; y < height; ++y) for (x = 0; x < width; ++x) {
+		int32_t pos = y * width + x;
 		float p[3] = {
 			samples[1][pos] + samples[0][pos],
 			samples[1][pos] - samples[0][pos],
@@ -7219,29 +8023,94 @@ J40__STATIC_RETURNS_ERR j40__combine_vardct_from_lf_group(j40__st *st, const j40
 			samples[c][pos] = (pp * pp * pp + im->opsin_bias[c]) * itscale;
 		}
 	}
-	for (c = 0; c < 3; ++c) {
-		if (f->gmodular.channel[c].type == J40__PLANE_I16) {
-			for (y = 0; y < ggh; ++y) {
-				int16_t *pixels = J40__I16_PIXELS(&f->gmodular.channel[c], gg->top + y);
-				for (x = 0; x < ggw; ++x) {
-					int32_t p = y * ggw + x;
-					float v = 
+
+	if (out[0].type == J40__PLANE_U8) {
+		for (y = 0; y < height; ++y) {
+			uint8_t *pixels = J40__U8_PIXELS(&out[0], top + y) + left * 4;
+			for (c = 0; c < 3; ++c) {
+				for (x = 0; x < width; ++x) {
+					int32_t p = y * width + x;
+					float v =
 						samples[0][p] * im->opsin_inv_mat[c][0] +
 						samples[1][p] * im->opsin_inv_mat[c][1] +
 						samples[2][p] * im->opsin_inv_mat[c][2];
-					// TODO very, very slow; probably different approximations per bpp ranges may be needed
-					v = (v <= 0.0031308f ? 12.92f * v : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f); // to sRGB
-					// TODO overflow check
-					pixels[gg->left + x] = (int16_t) ((float) ((1 << im->bpp) - 1) * v + 0.5f);
+					if (fixed) {
+						v = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; // also maps NaN to 0
+						pixels[x * 4 + c] = lut8[(int32_t) (v * (float) (1 << J40__FIXED_LINEAR_BITS) + 0.5f)];
+					} else {
+						v = 255.0f * j40__srgb_transfer(v, lut) + 0.5f;
+						pixels[x * 4 + c] = (uint8_t) (v > 0.0f ? (v < 255.0f ? v : 255.0f) : 0.0f);
+					}
 				}
 			}
-		} else {
-			J40__RAISE("TODO: don't keep this here");
+			for (x = 0; x < width; ++x) pixels[x * 4 + 3] = 255;
+		}
+		return 0;
+	}
+
+	for (c = 0; c < 3; ++c) {
+		if (out[c].type == J40__PLANE_I16 && fixed) {
+			for (y = 0; y < height; ++y) {
+				int16_t *pixels = J40__I16_PIXELS(&out[c], top + y);
+				for (x = 0; x < width; ++x) {
+					int32_t p = y * width + x;
+					float v =
+						samples[0][p] * im->opsin_inv_mat[c][0] +
+						samples[1][p] * im->opsin_inv_mat[c][1] +
+						samples[2][p] * im->opsin_inv_mat[c][2];
+					v = v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; // also maps NaN to 0
+					pixels[left + x] = (int16_t) lut8[(int32_t) (v * (float) (1 << J40__FIXED_LINEAR_BITS) + 0.5f)];
+				}
+			}
+		} else if (out[c].type == J40__PLANE_I16) {
+			for (y = 0; y < height; ++y) {
+				int16_t *pixels = J40__I16_PIXELS(&out[c], top + y);
+				for (x = 0; x < width; ++x) {
+					int32_t p = y * width + x;
+					float v =
+						samples[0][p] * im->opsin_inv_mat[c][0] +
+						samples[1][p] * im->opsin_inv_mat[c][1] +
+						samples[2][p] * im->opsin_inv_mat[c][2];
+					// TODO overflow check
+					pixels[left + x] = (int16_t) ((float) ((1 << im->bpp) - 1) * j40__srgb_transfer(v, lut) + 0.5f);
+				}
+			}
+		} else {
+			J40__RAISE("TODO: don't keep this here");
 		}
 	}
 
 J40__ON_ERROR:
-	j40__free(scratch);
+	return st->err;
+}
+
+// writes the LF image of `gg` (which should have been kept) into `out` as a 1:8 downscaled frame.
+// this is exact for DCT8x8 blocks and a box-filtered approximation otherwise.
+J40__STATIC_RETURNS_ERR j40__lf_image_from_lf_group(j40__st *st, const j40__lf_group_st *gg, j40__plane out[3]) {
+	j40__frame_st *f = st->frame;
+	int32_t ggw8 = gg->width8, ggh8 = gg->height8;
+	float *samples[3] = {0}, kx_lf, kb_lf;
+	int32_t x, y, c;
+
+	J40__ASSERT(gg->lfquant[0].type == J40__PLANE_F32);
+	for (c = 0; c < 3; ++c) J40__TRY_MALLOC(float, &samples[c], (size_t) (ggw8 * ggh8));
+
+	// same chroma from luma as LLF coefficients in j40__combine_vardct_from_lf_group
+	kx_lf = f->base_corr_x + (float) f->x_factor_lf * f->inv_colour_factor;
+	kb_lf = f->base_corr_b + (float) f->b_factor_lf * f->inv_colour_factor;
+	for (y = 0; y < ggh8; ++y) {
+		float *xrow = J40__F32_PIXELS(&gg->lfquant[0], y);
+		float *yrow = J40__F32_PIXELS(&gg->lfquant[1], y);
+		float *brow = J40__F32_PIXELS(&gg->lfquant[2], y);
+		for (x = 0; x < ggw8; ++x) {
+			samples[0][y * ggw8 + x] = xrow[x] + yrow[x] * kx_lf;
+			samples[1][y * ggw8 + x] = yrow[x];
+			samples[2][y * ggw8 + x] = brow[x] + yrow[x] * kb_lf;
+		}
+	}
+	J40__TRY(j40__xyb_to_srgb(st, samples, ggw8, ggh8, out, gg->left >> 3, gg->top >> 3));
+
+J40__ON_ERROR:
 	for (c = 0; c < 3; ++c) j40__free(samples[c]);
 	return st->err;
 }
@@ -7616,8 +8485,8 @@ J40__STATIC_RETURNS_ERR j40__epf(j40__st *st, j40__plane channels[3], const j40_
 	}
 
 J40__ON_ERROR:
-	if (recip_sigmas) j40__free_plane(recip_sigmas);
-	for (k = 0; k < maxnkernels; ++k) for (c = 0; c < 3; ++c) j40__free_plane(&distances[k][c]);
+	if (recip_sigmas) j40__release_plane(st->pool, recip_sigmas);
+	for (k = 0; k < maxnkernels; ++k) for (c = 0; c < 3; ++c) j40__release_plane(st->pool, &distances[k][c]);
 	return st->err;
 }
 
@@ -7648,11 +8517,12 @@ J40__STATIC_RETURNS_ERR j40__init_section_state(
 );
 J40__STATIC_RETURNS_ERR j40__finish_section_state(j40__st **stptr, j40__section_st *sst, j40_err err);
 
+J40_STATIC void j40__prefetch_sections(j40__st *st, j40__toc *toc);
+
 J40__STATIC_RETURNS_ERR j40__lf_global_in_section(j40__st *st, const j40__toc *toc);
 J40__STATIC_RETURNS_ERR j40__hf_global_in_section(j40__st *st, const j40__toc *toc);
 J40__STATIC_RETURNS_ERR j40__lf_or_pass_group_in_section(j40__st *st, j40__toc *toc, j40__lf_group_st *ggs);
 
-J40__STATIC_RETURNS_ERR j40__combine_vardct(j40__st *st, j40__lf_group_st *ggs);
 
 #ifdef J40_IMPLEMENTATION
 
@@ -7754,20 +8624,19 @@ J40__STATIC_RETURNS_ERR j40__init_section_state(
 ) {
 	static const j40__buffer_st BUFFER_INIT = J40__INIT;
 	j40__st *st = *stptr;
-	int64_t fileoff, codeoff_limit;
+	int64_t fileoff;
 
 	sst->parent = NULL;
 
 	J40__ASSERT(codeoff <= INT64_MAX - size);
 	J40__TRY(j40__map_codestream_offset(st, codeoff, &fileoff));
-	J40__SHOULD(j40__add64(codeoff, size, &codeoff_limit), "flen");
 
 	J40__TRY(j40__seek_from_source(st, fileoff)); // doesn't alter st->buffer
 
 	sst->st = *st;
 	sst->buffer = BUFFER_INIT;
 	sst->st.buffer = &sst->buffer;
-	J40__TRY(j40__init_buffer(&sst->st, codeoff, codeoff_limit));
+	J40__TRY(j40__init_section_buffer(&sst->st, codeoff, size));
 
 J40__ON_ERROR:
 	sst->parent = st;
@@ -7805,10 +8674,43 @@ J40__ON_ERROR:
 	sst->st.buffer = NULL;
 	sst->st.image = NULL;
 	sst->st.frame = NULL;
+	sst->st.pool = NULL;
 
 	return st->err;
 }
 
+// the number of sections to be prefetched ahead of the section currently being decoded.
+// sections are consumed in the TOC order (see j40__read_toc), which is what we follow here.
+#define J40__PREFETCH_SECTIONS 8
+
+// keeps up to J40__PREFETCH_SECTIONS sections past the current one hinted to the source.
+// the very first call also hints LfGlobal and HfGlobal (or the sole section if single_size),
+// which are read before anything else. safe to call multiple times, e.g. after a retry.
+J40_STATIC void j40__prefetch_sections(j40__st *st, j40__toc *toc) {
+	int64_t limit;
+
+	if (!st->source->prefetch_func) return;
+
+	if (toc->single_size) {
+		if (toc->nsections_prefetched == 0) {
+			j40__prefetch_codestream(st, toc->end_codeoff - toc->single_size, toc->single_size);
+			toc->nsections_prefetched = 1; // no other sections will be ever prefetched
+		}
+		return;
+	}
+
+	if (toc->nsections_prefetched == 0) {
+		j40__prefetch_codestream(st, toc->lf_global_codeoff, toc->lf_global_size);
+		j40__prefetch_codestream(st, toc->hf_global_codeoff, toc->hf_global_size);
+	}
+
+	limit = j40__min64(toc->nsections, toc->nsections_read + J40__PREFETCH_SECTIONS);
+	for (; toc->nsections_prefetched < limit; ++toc->nsections_prefetched) {
+		const j40__section *section = &toc->sections[toc->nsections_prefetched];
+		j40__prefetch_codestream(st, section->codeoff, section->size);
+	}
+}
+
 J40__STATIC_RETURNS_ERR j40__lf_global_in_section(j40__st *st, const j40__toc *toc) {
 	j40__section_st sst = J40__INIT;
 	if (!toc->single_size) {
@@ -7837,7 +8739,11 @@ J40__STATIC_RETURNS_ERR j40__lf_or_pass_group_in_section(j40__st *st, j40__toc *
 	j40__section section = toc->sections[toc->nsections_read];
 	j40__section_st sst = J40__INIT;
 
-	if (section.pass < 0) { // LF group
+	j40__prefetch_sections(st, toc);
+
+	if (section.pass < 0 && !j40__lf_group_in_region(st->frame, &ggs[section.idx])) {
+		ggs[section.idx].loaded = 1; // never decoded, and pass groups will be skipped as well
+	} else if (section.pass < 0) { // LF group
 		j40__lf_group_st *gg = &ggs[section.idx];
 		J40__TRY(j40__init_section_state(&st, &sst, section.codeoff, section.size));
 		J40__TRY(j40__finish_section_state(&st, &sst, j40__lf_group(st, gg)));
@@ -7848,9 +8754,13 @@ J40__STATIC_RETURNS_ERR j40__lf_or_pass_group_in_section(j40__st *st, j40__toc *
 		struct j40__group_info info = j40__group_info(st->frame, section.idx);
 		j40__lf_group_st *gg = &ggs[info.ggidx];
 		J40__ASSERT(gg->loaded); // j40__read_toc should have taken care of this
-		J40__TRY(j40__init_section_state(&st, &sst, section.codeoff, section.size));
-		J40__TRY(j40__finish_section_state(&st, &sst, j40__pass_group(
-			st, section.pass, info.gx_in_gg, info.gy_in_gg, info.gw, info.gh, section.idx, gg)));
+		// skipped if not needed for the output (see j40__plan_output and j40_output_region)
+		if (section.pass < st->frame->max_passes && j40__group_in_region(st->frame, section.idx)) {
+			J40__TRY(j40__init_section_state(&st, &sst, section.codeoff, section.size));
+			J40__TRY(j40__finish_section_state(&st, &sst, j40__pass_group(
+				st, section.pass, info.gx_in_gg, info.gy_in_gg, info.gw, info.gh, section.idx, gg)));
+		}
+		++gg->num_pass_groups_read;
 	}
 
 	++toc->nsections_read;
@@ -7859,28 +8769,6 @@ J40__ON_ERROR:
 	return st->err;
 }
 
-J40__STATIC_RETURNS_ERR j40__combine_vardct(j40__st *st, j40__lf_group_st *ggs) {
-	j40__frame_st *f = st->frame;
-	int64_t i;
-
-	// TODO pretty incorrect to do this
-	J40__SHOULD(!f->do_ycbcr && st->image->cspace != J40__CS_GREY, "TODO: we don't yet do YCbCr or gray");
-	J40__SHOULD(st->image->modular_16bit_buffers, "TODO: !modular_16bit_buffers");
-	f->gmodular.num_channels = 3;
-	J40__TRY_CALLOC(j40__plane, &f->gmodular.channel, 3);
-	for (i = 0; i < f->gmodular.num_channels; ++i) {
-		J40__TRY(j40__init_plane(
-			st, J40__PLANE_I16, f->width, f->height, J40__PLANE_FORCE_PAD, &f->gmodular.channel[i]));
-	}
-	for (i = 0; i < f->num_lf_groups; ++i) {
-		j40__dequant_hf(st, &ggs[i]);
-		J40__TRY(j40__combine_vardct_from_lf_group(st, &ggs[i]));
-	}
-
-J40__ON_ERROR:
-	return st->err;
-}
-
 J40__STATIC_RETURNS_ERR j40__end_of_frame(j40__st *st, const j40__toc *toc) {
 	J40__TRY(j40__zero_pad_to_byte(st));
 	if (toc->single_size) {
@@ -7903,16 +8791,43 @@ J40__ON_ERROR:
 ////////////////////////////////////////////////////////////////////////////////
 // rendering (currently very limited)
 
+J40__STATIC_RETURNS_ERR j40__rgba_channels(
+	j40__st *st, j40__plane *channels, int32_t num_channels, j40__plane *out[4]
+);
+J40_STATIC void j40__render_rows_to_u8x4_rgba(
+	j40__st *st, j40__plane *const c[4], int32_t y0, int32_t width, int32_t height, j40__plane *out
+);
 J40__STATIC_RETURNS_ERR j40__render_to_u8x4_rgba(j40__st *st, j40__plane *out);
+J40_STATIC void j40__downscale_u8x4(
+	const j40__plane *src, int32_t y0, int32_t width, int32_t height, int32_t shift, j40__plane *out
+);
+
+// separable resampling of U8X4 rows, which are pushed in order and consumed as soon as possible
+typedef struct j40__resize_st {
+	int32_t srcw, srch, dstw, dsth;
+	int32_t xtaps, ytaps; // weights per output pixel (zero-padded), also ytaps = number of ring rows
+	int32_t *xstart, *ystart; // [dstw] and [dsth], the first source pixel for each output pixel
+	float *xweights, *yweights; // [dstw * xtaps] and [dsth * ytaps]
+	float *ring; // [ytaps][dstw * 4], horizontally resampled source rows
+	int32_t srcy; // the next source row to be pushed
+	int32_t dsty; // the next output row to be produced
+} j40__resize_st;
+
+J40__STATIC_RETURNS_ERR j40__init_resize(
+	j40__st *st, int32_t srcw, int32_t srch, int32_t dstw, int32_t dsth, int32_t filter, j40__resize_st *rs
+);
+J40_STATIC void j40__resize_push_row(j40__resize_st *rs, const uint8_t *row, j40__plane *out);
+J40_STATIC void j40__free_resize(j40__resize_st *rs);
 
 #ifdef J40_IMPLEMENTATION
 
-J40__STATIC_RETURNS_ERR j40__render_to_u8x4_rgba(j40__st *st, j40__plane *out) {
+// checks if rendering is possible and picks color and alpha (can be NULL) channels from `channels`
+J40__STATIC_RETURNS_ERR j40__rgba_channels(
+	j40__st *st, j40__plane *channels, int32_t num_channels, j40__plane *out[4]
+) {
 	j40__image_st *im = st->image;
 	j40__frame_st *f = st->frame;
-	j40__plane *c[4], rgba = J40__INIT;
-	int32_t maxpixel, maxpixel2;
-	int32_t i, x, y;
+	int32_t i;
 
 	J40__SHOULD(im->modular_16bit_buffers, "TODO: specialize for 32-bit");
 	J40__SHOULD(im->bpp >= 8, "TODO: does not yet support <8bpp");
@@ -7920,31 +8835,44 @@ J40__STATIC_RETURNS_ERR j40__render_to_u8x4_rgba(j40__st *st, j40__plane *out) {
 	J40__SHOULD(!(!f->do_ycbcr && im->xyb_encoded && im->cspace == J40__CS_GREY),
 		"TODO: direct luma encoding not yet supported");
 
-	J40__ASSERT(f->gmodular.num_channels >= 3);
-	for (i = 0; i < 3; ++i) c[i] = &f->gmodular.channel[i];
-	c[3] = NULL;
-	for (i = 3; i < f->gmodular.num_channels; ++i) {
+	J40__ASSERT(num_channels >= 3);
+	for (i = 0; i < 3; ++i) out[i] = &channels[i];
+	out[3] = NULL;
+	for (i = 3; i < num_channels; ++i) {
 		j40__ec_info *ec = &im->ec_info[i - 3];
 		if (ec->type == J40__EC_ALPHA) {
 			J40__SHOULD(ec->bpp == im->bpp && ec->exp_bits == im->exp_bits,
 				"TODO: alpha channel has different bpp or sample type from color channels");
 			J40__SHOULD(ec->dim_shift == 0, "TODO: subsampled alpha not yet supported");
 			J40__SHOULD(!ec->data.alpha_associated, "TODO: associated alpha not yet supported");
-			c[3] = &f->gmodular.channel[i];
+			out[3] = &channels[i];
 			break;
 		}
 	}
 
 	J40__SHOULD(f->width < INT32_MAX / 4, "bigg");
-	J40__TRY(j40__init_plane(st, J40__PLANE_U8, f->width * 4, f->height, J40__PLANE_FORCE_PAD, &rgba));
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// renders rows [y0, y0 + height) of `c` into rows [0, height) of `out`
+J40_STATIC void j40__render_rows_to_u8x4_rgba(
+	j40__st *st, j40__plane *const c[4], int32_t y0, int32_t width, int32_t height, j40__plane *out
+) {
+	j40__image_st *im = st->image;
+	int32_t maxpixel, maxpixel2;
+	int32_t i, x, y;
+
+	J40__ASSERT(out->width >= width * 4 && out->height >= height);
 
 	maxpixel = (1 << im->bpp) - 1;
 	maxpixel2 = (1 << (im->bpp - 1));
-	for (y = 0; y < f->height; ++y) {
+	for (y = 0; y < height; ++y) {
 		int16_t *pixels[4];
-		uint8_t *outpixels = J40__U8_PIXELS(&rgba, y);
-		for (i = 0; i < 4; ++i) pixels[i] = c[i] ? J40__I16_PIXELS(c[i], y) : NULL;
-		for (x = 0; x < f->width; ++x) {
+		uint8_t *outpixels = J40__U8_PIXELS(out, y);
+		for (i = 0; i < 4; ++i) pixels[i] = c[i] ? J40__I16_PIXELS(c[i], y0 + y) : NULL;
+		for (x = 0; x < width; ++x) {
 			for (i = 0; i < 4; ++i) {
 				// TODO optimize
 				int32_t p = j40__min32(j40__max32(0, pixels[i] ? pixels[i][x] : maxpixel), maxpixel);
@@ -7952,6 +8880,15 @@ J40__STATIC_RETURNS_ERR j40__render_to_u8x4_rgba(j40__st *st, j40__plane *out) {
 			}
 		}
 	}
+}
+
+J40__STATIC_RETURNS_ERR j40__render_to_u8x4_rgba(j40__st *st, j40__plane *out) {
+	j40__frame_st *f = st->frame;
+	j40__plane *c[4], rgba = J40__INIT;
+
+	J40__TRY(j40__rgba_channels(st, f->gmodular.channel, f->gmodular.num_channels, c));
+	J40__TRY(j40__init_plane(st, J40__PLANE_U8, f->width * 4, f->height, J40__PLANE_FORCE_PAD, &rgba));
+	j40__render_rows_to_u8x4_rgba(st, c, 0, f->width, f->height, &rgba);
 
 	*out = rgba;
 	return 0;
@@ -7961,6 +8898,149 @@ J40__ON_ERROR:
 	return st->err;
 }
 
+// box-filters rows [0, height) of `src`, which are frame rows [y0, y0 + height) with given `width`,
+// by the factor of `1 << shift` into corresponding rows of `out`. `y0` should be a multiple of
+// the factor, and partial blocks at right and bottom edges are averaged over available pixels only.
+J40_STATIC void j40__downscale_u8x4(
+	const j40__plane *src, int32_t y0, int32_t width, int32_t height, int32_t shift, j40__plane *out
+) {
+	int32_t size = 1 << shift, x, y, yy, xx, i;
+
+	J40__ASSERT(y0 % size == 0);
+	for (y = 0; y < height; y += size) {
+		int32_t bh = j40__min32(size, height - y);
+		uint8_t *outpixels = J40__U8_PIXELS(out, (y0 + y) >> shift);
+		for (x = 0; x < width; x += size) {
+			int32_t bw = j40__min32(size, width - x), n = bw * bh;
+			int32_t sum[4] = {0, 0, 0, 0};
+			for (yy = 0; yy < bh; ++yy) {
+				const uint8_t *pixels = J40__U8_PIXELS(src, y + yy) + x * 4;
+				for (xx = 0; xx < bw * 4; xx += 4) {
+					for (i = 0; i < 4; ++i) sum[i] += pixels[xx + i];
+				}
+			}
+			for (i = 0; i < 4; ++i) outpixels[(x >> shift) * 4 + i] = (uint8_t) ((sum[i] + n / 2) / n);
+		}
+	}
+}
+
+J40_INLINE float j40__sinc(float x) {
+	x *= 3.14159265358979f;
+	return x == 0.0f ? 1.0f : sinf(x) / x;
+}
+
+// computes resampling weights from `srcn` to `dstn` pixels. source pixels outside of the image
+// are folded into the nearest edge pixel, so that every window lies entirely inside the image.
+J40__STATIC_RETURNS_ERR j40__resize_weights(
+	j40__st *st, int32_t srcn, int32_t dstn, int32_t filter,
+	int32_t *outtaps, int32_t **outstart, float **outweights
+) {
+	float scale = (float) srcn / (float) dstn, s = j40__maxf(scale, 1.0f), support;
+	int32_t *start = NULL, taps, rawtaps, i, j;
+	float *weights = NULL;
+
+	support = filter == J40_FILTER_AREA ? scale * 0.5f : 3.0f * s;
+	rawtaps = (int32_t) ceilf(support * 2.0f) + 2;
+	taps = j40__min32(rawtaps, srcn);
+	J40__TRY_MALLOC(int32_t, &start, (size_t) dstn);
+	J40__TRY_CALLOC(float, &weights, (size_t) dstn * (size_t) taps);
+
+	for (i = 0; i < dstn; ++i) {
+		float center = ((float) i + 0.5f) * scale, sum = 0.0f, *w = weights + (size_t) i * (size_t) taps;
+		int32_t lo = (int32_t) floorf(center - support);
+		start[i] = j40__min32(j40__max32(lo, 0), srcn - taps);
+		for (j = lo; j < lo + rawtaps; ++j) {
+			float v;
+			if (filter == J40_FILTER_AREA) { // overlap between [j, j+1) and [center-support, center+support)
+				v = j40__minf((float) (j + 1), center + support) - j40__maxf((float) j, center - support);
+				if (v <= 0.0f) continue;
+			} else {
+				float x = ((float) j + 0.5f - center) / s;
+				if (!(-3.0f < x && x < 3.0f)) continue;
+				v = j40__sinc(x) * j40__sinc(x / 3.0f);
+			}
+			w[j40__min32(j40__max32(j, 0), srcn - 1) - start[i]] += v;
+			sum += v;
+		}
+		if (sum != 0.0f) {
+			for (j = 0; j < taps; ++j) w[j] /= sum;
+		} else { // can't happen in practice, but let's be safe
+			w[j40__min32(j40__max32((int32_t) center, start[i]), start[i] + taps - 1) - start[i]] = 1.0f;
+		}
+	}
+
+	*outtaps = taps;
+	*outstart = start;
+	*outweights = weights;
+	return 0;
+
+J40__ON_ERROR:
+	j40__free(start);
+	j40__free(weights);
+	return st->err;
+}
+
+J40__STATIC_RETURNS_ERR j40__init_resize(
+	j40__st *st, int32_t srcw, int32_t srch, int32_t dstw, int32_t dsth, int32_t filter, j40__resize_st *rs
+) {
+	j40__resize_st r = J40__INIT;
+
+	J40__ASSERT(srcw > 0 && srch > 0 && dstw > 0 && dsth > 0);
+	r.srcw = srcw; r.srch = srch; r.dstw = dstw; r.dsth = dsth;
+	J40__TRY(j40__resize_weights(st, srcw, dstw, filter, &r.xtaps, &r.xstart, &r.xweights));
+	J40__TRY(j40__resize_weights(st, srch, dsth, filter, &r.ytaps, &r.ystart, &r.yweights));
+	J40__TRY_MALLOC(float, &r.ring, (size_t) r.ytaps * (size_t) dstw * 4);
+	*rs = r;
+	return 0;
+
+J40__ON_ERROR:
+	j40__free_resize(&r);
+	return st->err;
+}
+
+// resamples the next source row `row` horizontally, and writes every output row that no longer
+// needs any more source rows into `out` (whose rows correspond to output rows)
+J40_STATIC void j40__resize_push_row(j40__resize_st *rs, const uint8_t *row, j40__plane *out) {
+	float *ringrow = rs->ring + (size_t) (rs->srcy % rs->ytaps) * (size_t) rs->dstw * 4;
+	int32_t x, k, i;
+
+	J40__ASSERT(rs->srcy < rs->srch);
+	for (x = 0; x < rs->dstw; ++x) {
+		const uint8_t *p = row + rs->xstart[x] * 4;
+		const float *w = rs->xweights + (size_t) x * (size_t) rs->xtaps;
+		float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+		for (k = 0; k < rs->xtaps; ++k) {
+			for (i = 0; i < 4; ++i) sum[i] += w[k] * (float) p[k * 4 + i];
+		}
+		for (i = 0; i < 4; ++i) ringrow[x * 4 + i] = sum[i];
+	}
+	++rs->srcy;
+
+	while (rs->dsty < rs->dsth && rs->ystart[rs->dsty] + rs->ytaps <= rs->srcy) {
+		const float *w = rs->yweights + (size_t) rs->dsty * (size_t) rs->ytaps;
+		uint8_t *outpixels = J40__U8_PIXELS(out, rs->dsty);
+		for (x = 0; x < rs->dstw * 4; ++x) {
+			float sum = 0.0f;
+			for (k = 0; k < rs->ytaps; ++k) {
+				int32_t slot = (rs->ystart[rs->dsty] + k) % rs->ytaps;
+				sum += w[k] * rs->ring[(size_t) slot * (size_t) rs->dstw * 4 + (size_t) x];
+			}
+			outpixels[x] = (uint8_t) j40__min32(j40__max32(0, (int32_t) (sum + 0.5f)), 255);
+		}
+		++rs->dsty;
+	}
+}
+
+J40_STATIC void j40__free_resize(j40__resize_st *rs) {
+	j40__free(rs->xstart);
+	j40__free(rs->ystart);
+	j40__free(rs->xweights);
+	j40__free(rs->yweights);
+	j40__free(rs->ring);
+	rs->xstart = rs->ystart = NULL;
+	rs->xweights = rs->yweights = rs->ring = NULL;
+}
+
 #endif // defined J40_IMPLEMENTATION
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -7977,11 +9057,23 @@ J40__ON_ERROR:
 #define J40__FOREACH_API(X) \
 	X(from_file,) \
 	X(from_memory,) \
+	X(from_shared,) \
 	/* the last origin that can use alternative magic numbers, see J40__ORIGIN_LAST_ALT_MAGIC */ \
 	X(output_format,) \
+	X(output_rows,_u8x4) \
+	X(next_event,) \
+	X(output_levels,) \
+	X(output_size,) \
+	X(output_region,) \
+	X(output_quality,) \
+	X(save_toc_index,) \
+	X(load_toc_index,) \
+	X(use_tile_cache,) \
+	X(decode_batch,) \
 	X(next_frame,) \
 	X(current_frame,) \
 	X(frame_pixels,_*) \
+	X(frame_level,_*) \
 	X(error_string,) \
 	X(free,) \
 
@@ -7991,7 +9083,7 @@ typedef enum { // each API defines its origin value; they don't have to be stabl
 #define J40__ORIGIN_ENUM_VALUE(origin, suffix) J40__ORIGIN_##origin,
 	J40__FOREACH_API(J40__ORIGIN_ENUM_VALUE)
 	J40__ORIGIN_MAX,
-	J40__ORIGIN_LAST_ALT_MAGIC = J40__ORIGIN_from_memory,
+	J40__ORIGIN_LAST_ALT_MAGIC = J40__ORIGIN_from_shared,
 } j40__origin;
 
 static const char *J40__ORIGIN_NAMES[] = {
@@ -8008,6 +9100,18 @@ static const struct { char err[5]; const char *msg, *suffix; } J40__ERROR_STRING
 	{ "Ufm?", "Bad `format` parameter", NULL },
 	{ "Uof?", "Bad `channel` and `format` combination", NULL },
 	{ "Urnd", "Frame is not yet rendered", NULL },
+	{ "Ufn0", "`func` parameter is NULL", NULL },
+	{ "Ulat", "Output options should be set before decoding", NULL },
+	{ "Ulvl", "Bad `nlevels` or `level` parameter", NULL },
+	{ "Usz?", "Bad `width` or `height` parameter", NULL },
+	{ "Uflt", "Unknown resampling filter", NULL },
+	{ "Uoex", "Given output options can't be used together", NULL },
+	{ "Urgn", "Bad region or region outside of the frame", NULL },
+	{ "Uqlt", "Bad `flags` parameter", NULL },
+	{ "Ush0", "`shared` parameter is NULL", NULL },
+	{ "Uidn", "TOC index is not yet available", NULL },
+	{ "Uidx", "TOC index is corrupted or doesn't match the image", NULL },
+	{ "Ubsz", "Output buffer is too small", NULL },
 	{ "Ufre", "Trying to reuse already freed image", NULL },
 	{ "!mem", "Out of memory", NULL },
 	{ "!jxl", "The JPEG XL signature is not found", NULL },
@@ -8043,6 +9147,9 @@ typedef struct j40__inner {
 	char errbuf[J40__ERRBUF_LEN];
 
 	int state; // used in j40_advance
+	int want_events; // if set, j40__advance returns early at each event (see J40__YIELD_EVENT)
+	int event; // the last event returned by j40__advance, or 0
+	int lf_event_done;
 
 	// subsystem contexts; copied to and from j40__st whenever needed
 	struct j40__bits_st bits;
@@ -8052,13 +9159,102 @@ typedef struct j40__inner {
 	struct j40__image_st image;
 	struct j40__frame_st frame;
 	struct j40__lf_group_st *lf_groups; // [frame.num_lf_groups]
+	struct j40__pool_st pool;
 
 	j40__toc toc;
 
 	int rendered;
-	j40__plane rendered_rgba;
+	j40__plane rendered_rgba; // VarDCT frames are directly rendered here while decoding (see j40__combine_vardct)
+
+	// streaming output, only used when rows_func is set (see j40__stream_band)
+	j40_rows_u8x4_func rows_func;
+	int streaming_limits; // set by j40_output_rows_u8x4 only, relaxes image dimensions (see j40__init_state)
+	void *rows_data;
+	int32_t stream_y; // the first frame row not yet delivered
+	j40__plane stream_channels[3]; // VarDCT only, I16 planes for a single LF group row
+	j40__plane stream_rgba; // rendered rows for a single LF group row
+
+	// mip pyramid output (see j40_output_levels), levels[0] is unused as it's the frame itself
+	int32_t nlevels;
+	j40__plane levels[J40_MAX_LEVELS]; // U8, (ceil(width / 2^k) * 4) x ceil(height / 2^k)
+	j40__plane lf_channels[3]; // I16, ceil(width / 8) x ceil(height / 8), only when frame.keep_lf is set
+
+	// resized output (see j40_output_size), rendered_rgba always has the output size in this case
+	int32_t out_width, out_height, out_filter;
+	j40__resize_st resize;
+	j40__plane resize_row; // a single source row being fed to the resizer
+	j40__plane resize_src; // VarDCT only, the whole frame rendered by j40__combine_vardct before resizing
+
+	// shared frame state (see j40_shared_from_memory)
+	int sharing; // set while j40_shared_from_memory runs, stops after HfGlobal
+	struct j40_shared *shared; // if set, image, frame (but gmodular) and toc are owned by `shared`
+	int start_state; // the initial `state`, output options can be only set before leaving it
+
+	// TOC index loaded by j40_load_toc_index, used in place of j40__read_toc if `has_index` is set
+	int has_index;
+	uint32_t index_fingerprint; // see j40__toc_crc32
+	j40__toc index_toc;
+
+	// decoded tile cache for the region output (see j40_use_tile_cache), not owned
+	struct j40_tile_cache *tile_cache;
+	uint64_t tile_image_id;
 } j40__inner;
 
+// returned by j40__advance only when `sharing` is set; never visible to j40_next_event
+#define J40__EVENT_SHARED 0x100
+
+// J40__ATOMIC_ADD(p, v) adds v to *p and returns the new value, where p points to J40__ATOMIC_LONG.
+// without any known atomic primitive it falls back to a plain addition, and then j40_from_shared
+// and j40_free (of attached images) and j40_free_shared should be serialized by the caller.
+#if defined _MSC_VER
+	#define J40__ATOMIC_LONG volatile long
+	#define J40__ATOMIC_ADD(p, v) (_InterlockedExchangeAdd((p), (v)) + (v))
+#elif defined __GNUC__ // also covers Clang
+	#define J40__ATOMIC_LONG long
+	#define J40__ATOMIC_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#elif !defined __cplusplus && defined __STDC_VERSION__ && __STDC_VERSION__ >= 201112L && !defined __STDC_NO_ATOMICS__
+	#include <stdatomic.h>
+	#define J40__ATOMIC_LONG _Atomic long
+	#define J40__ATOMIC_ADD(p, v) (atomic_fetch_add((p), (v)) + (v))
+#else
+	#define J40__ATOMIC_LONG long
+	#define J40__ATOMIC_ADD(p, v) (*(p) += (v)) // not thread-safe, see above
+#endif
+
+struct j40_shared {
+	J40__ATOMIC_LONG refcount; // updated atomically, see J40__ATOMIC_ADD
+	uint8_t *buf;
+	size_t size;
+	j40_memory_free_func freefunc;
+	j40__container_st container; // copied to each attached decoder, as it can grow
+	j40__image_st image;
+	j40__frame_st frame; // after HfGlobal, with all DQ matrices and coefficient orders prepared
+	j40__toc toc;
+	int state; // `inner->state` right after HfGlobal
+};
+
+// a single rendered group in the tile cache, linked both to the hash bucket and the LRU list
+// tiles are only reused for the same output options, as any of them changes the pixels
+typedef struct {
+	uint64_t image_id; int64_t gidx; int32_t passes, format; int approx_transfer, fixed_point;
+} j40__tile_key;
+typedef struct j40__tile {
+	j40__tile_key key;
+	int32_t width, height;
+	uint8_t *pixels; // tightly packed U8X4, (width * 4) x height
+	struct j40__tile *hnext; // the next tile in the same bucket
+	struct j40__tile *newer, *older;
+} j40__tile;
+
+#define J40__TILE_BUCKETS 1024
+
+struct j40_tile_cache {
+	size_t budget, bytes; // `bytes` only counts pixels
+	j40__tile *buckets[J40__TILE_BUCKETS];
+	j40__tile *newest, *oldest;
+	uint64_t hits, misses, evictions;
+};
+
 J40__STATIC_RETURNS_ERR j40__set_alt_magic(
 	j40_err err, int saved_errno, j40__origin origin, j40_image *image
 );
@@ -8074,8 +9270,52 @@ J40_STATIC j40_err j40__check_image(j40_image *image, j40__origin neworigin, j40
 J40_STATIC void j40__init_state(j40__st *st, j40__inner *inner);
 J40_STATIC void j40__save_state(j40__st *st, j40__inner *inner, j40__origin origin);
 
+J40_STATIC int j40__band_ready(const j40__inner *inner, int final);
+J40__STATIC_RETURNS_ERR j40__stream_band(j40__st *st, j40__inner *inner, int final);
+J40__STATIC_RETURNS_ERR j40__update_levels(
+	j40__st *st, j40__inner *inner, const j40__plane *rgba, int32_t y0, int32_t height
+);
+J40__STATIC_RETURNS_ERR j40__lf_level(j40__st *st, j40__inner *inner, j40__lf_group_st *gg);
+J40__STATIC_RETURNS_ERR j40__combine_vardct(j40__st *st, j40__inner *inner, int final);
+J40__STATIC_RETURNS_ERR j40__finish_levels(j40__st *st, j40__inner *inner, int has_alpha);
+J40__STATIC_RETURNS_ERR j40__render_levels(j40__st *st, j40__inner *inner);
+J40__STATIC_RETURNS_ERR j40__plan_output(j40__st *st, j40__inner *inner);
+J40_STATIC void j40__resize_rows(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t y0, int32_t height
+);
+J40__STATIC_RETURNS_ERR j40__stream_resized(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t height
+);
+J40__STATIC_RETURNS_ERR j40__render_resized(j40__st *st, j40__inner *inner);
+J40_STATIC j40__tile **j40__tile_slot(j40_tile_cache *cache, j40__tile_key key);
+J40_STATIC void j40__unlink_tile(j40_tile_cache *cache, j40__tile **slot);
+J40_STATIC const j40__tile *j40__get_tile(j40_tile_cache *cache, j40__tile_key key);
+J40__STATIC_RETURNS_ERR j40__put_tile(
+	j40__st *st, j40_tile_cache *cache, j40__tile_key key, int32_t width, int32_t height,
+	const uint8_t *pixels, size_t stride_bytes
+);
+J40_STATIC void j40__blit_tile(
+	const j40__frame_st *f, int32_t x, int32_t y, int32_t width, int32_t height,
+	const uint8_t *pixels, size_t stride_bytes, j40__plane *out
+);
+J40__STATIC_RETURNS_ERR j40__fetch_tiles(j40__st *st, j40__inner *inner);
+J40__STATIC_RETURNS_ERR j40__render_tiles(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t left, int32_t top, int32_t width
+);
+J40__STATIC_RETURNS_ERR j40__render_region(j40__st *st, j40__inner *inner);
+J40__STATIC_RETURNS_ERR j40__prepare_shared(j40__st *st, const j40__toc *toc);
+J40__STATIC_RETURNS_ERR j40__attach_shared(j40__st *st, j40__inner *inner, struct j40_shared *shared);
+J40_STATIC void j40__release_shared(struct j40_shared *shared);
+J40_STATIC uint32_t j40__crc32(uint32_t crc, const uint8_t *p, size_t n);
+J40__STATIC_RETURNS_ERR j40__toc_crc32(j40__st *st, const j40__toc *toc, uint32_t *out);
+J40__STATIC_RETURNS_ERR j40__save_index(j40__st *st, const j40__inner *inner, uint8_t **out, size_t *outsize);
+J40__STATIC_RETURNS_ERR j40__load_index(j40__st *st, j40__inner *inner, const uint8_t *p, size_t size);
+J40__STATIC_RETURNS_ERR j40__toc_from_index(j40__st *st, j40__inner *inner);
+J40_STATIC int j40__lf_event_pending(j40__inner *inner);
 J40__STATIC_RETURNS_ERR j40__advance(j40__inner *inner, j40__origin origin/*, int32_t until*/);
 
+// frees everything except for the pool, so that `inner` can be reused for another image
+J40_STATIC void j40__reset_inner(j40__inner *inner);
 J40_STATIC void j40__free_inner(j40__inner *inner);
 
 #ifdef J40_IMPLEMENTATION
@@ -8128,7 +9368,9 @@ J40_STATIC void j40__init_state(j40__st *st, j40__inner *inner) {
 	st->buffer = &inner->buffer;
 	st->image = &inner->image;
 	st->frame = &inner->frame;
-	st->limits = &J40__MAIN_LV5_LIMITS;
+	st->pool = &inner->pool;
+	// streaming output never keeps the whole VarDCT frame, so much larger images can be handled
+	st->limits = inner->streaming_limits ? &J40__MAIN_LV5_STREAMING_LIMITS : &J40__MAIN_LV5_LIMITS;
 }
 
 J40_STATIC void j40__save_state(j40__st *st, j40__inner *inner, j40__origin origin) {
@@ -8142,110 +9384,1045 @@ J40_STATIC void j40__save_state(j40__st *st, j40__inner *inner, j40__origin orig
 	}
 }
 
-// TODO expose this with a proper interface
-J40__STATIC_RETURNS_ERR j40__advance(j40__inner *inner, j40__origin origin/*, int32_t until*/) {
-	j40__st stbuf, *st = &stbuf;
-	j40__frame_st *f;
-	j40_err err;
+// returns true if the next band of rows can be delivered to `inner->rows_func`.
+// bands are delivered strictly in order; for VarDCT, each band corresponds to a single row of
+// LF groups and is ready as soon as all sections of those LF groups have been read.
+// modular frames are only complete after the global inverse transform, so they are ready only when
+// `final` is set. `final` also forces remaining bands to be delivered regardless of their states.
+J40_STATIC int j40__band_ready(const j40__inner *inner, int final) {
+	const j40__frame_st *f = &inner->frame;
+	const j40__lf_group_st *row;
+	int32_t bandsize, i;
 
-	j40__init_state(st, inner);
+	if (!inner->rows_func || inner->stream_y >= f->height) return 0;
+	if (final) return 1;
+	if (f->is_modular) return 0;
 
-	// a less-known coroutine hack with some tweak.
-	// see https://www.chiark.greenend.org.uk/~sgtatham/coroutines.html for basic concepts.
-	//
-	// it is EXTREMELY important that any `J40__YIELD_AFTER` call may fail, and the next call
-	// to `j40_advance` will restart after the last successful `J40__YIELD_AFTER` call.
-	// therefore any code between two `J40__YIELD_AFTER` can run multiple times!
-	// if you don't want this, you should move the code into a separate function.
-	// for the same reason, this block can't contain any variable declaration or assignment.
-	#define J40__YIELD_AFTER(expr) \
-		do { \
-			err = (expr); \
-			j40__save_state(st, inner, origin); \
-			if (err) return err; \
-			inner->state = __LINE__; /* thus each line can have at most one J40__YIELD() call */ \
-			/* fall through */ \
-			case __LINE__:; \
-		} while (0)
+	bandsize = j40__min32(8 << f->group_size_shift, f->height);
+	row = &inner->lf_groups[(int64_t) (inner->stream_y / bandsize) * f->ggcolumns];
+	for (i = 0; i < f->ggcolumns; ++i) {
+		if (!row[i].loaded) return 0;
+		if (row[i].num_pass_groups_read < row[i].grows * row[i].gcolumns * f->num_passes) return 0;
+	}
+	return 1;
+}
 
-	f = st->frame;
-	switch (inner->state) {
-	case 0: // initial state
+// delivers the next band of rows to `inner->rows_func`, which should be ready (see j40__band_ready).
+// for VarDCT, LF groups for that band are combined and released immediately, so at most a single
+// row of coefficients and samples is kept (other than not-yet-complete rows).
+// TODO restoration filters would need an additional border row here once they are enabled
+J40__STATIC_RETURNS_ERR j40__stream_band(j40__st *st, j40__inner *inner, int final) {
+	j40__frame_st *f = st->frame;
+	int32_t bandsize = j40__min32(8 << f->group_size_shift, f->height);
+	int32_t height = j40__min32(bandsize, f->height - inner->stream_y);
+	j40__plane *c[4];
+	j40_pixels_u8x4 pixels;
+	int32_t i;
+	j40_err err;
 
-		J40__YIELD_AFTER(j40__init_buffer(st, 0, INT64_MAX));
-		J40__YIELD_AFTER(j40__signature(st));
-		J40__YIELD_AFTER(j40__image_metadata(st));
+	J40__ASSERT(j40__band_ready(inner, final));
 
-		if (st->image->want_icc) {
-			J40__YIELD_AFTER(j40__icc(st));
+	if (!f->is_modular && f->max_passes == 0) { // only the LF image is needed (see j40__plan_output)
+		j40__lf_group_st *row = &inner->lf_groups[(int64_t) (inner->stream_y / bandsize) * f->ggcolumns];
+		for (i = 0; i < f->ggcolumns; ++i) {
+			J40__TRY(j40__lf_level(st, inner, &row[i]));
+			j40__free_lf_group(&row[i]);
 		}
-
-		{ // TODO should really be a loop, should we support multiple frames
-			J40__YIELD_AFTER(j40__frame_header(st));
-			if (!f->is_last) J40__YIELD_AFTER(J40__ERR("TODO: multiple frames"));
-			if (f->type != J40__FRAME_REGULAR) J40__YIELD_AFTER(J40__ERR("TODO: non-regular frame"));
-			J40__YIELD_AFTER(j40__read_toc(st, &inner->toc));
-
-			J40__YIELD_AFTER(j40__lf_global_in_section(st, &inner->toc));
-			J40__YIELD_AFTER(j40__hf_global_in_section(st, &inner->toc));
-
-			J40__YIELD_AFTER(j40__allocate_lf_groups(st, &inner->lf_groups));
-
-			if (inner->toc.single_size) {
-				J40__ASSERT(f->num_lf_groups == 1 && f->num_groups == 1 && f->num_passes == 1);
-				J40__YIELD_AFTER(j40__lf_group(st, &inner->lf_groups[0]));
-				J40__YIELD_AFTER(j40__prepare_dq_matrices(st));
-				J40__YIELD_AFTER(j40__prepare_orders(st));
-				J40__YIELD_AFTER(j40__pass_group(st, 0, 0, 0, f->width, f->height, 0, &inner->lf_groups[0]));
-				J40__YIELD_AFTER(j40__zero_pad_to_byte(st));
-			} else {
-				while (inner->toc.nsections_read < inner->toc.nsections) {
-					J40__YIELD_AFTER(j40__lf_or_pass_group_in_section(st, &inner->toc, inner->lf_groups));
-				}
+		J40__TRY(j40__rgba_channels(st, inner->lf_channels, 3, c));
+	} else if (!f->is_modular) {
+		j40__lf_group_st *row = &inner->lf_groups[(int64_t) (inner->stream_y / bandsize) * f->ggcolumns];
+		if (!inner->stream_channels[0].type) {
+			for (i = 0; i < 3; ++i) {
+				J40__TRY(j40__init_plane(
+					st, J40__PLANE_I16, f->width, bandsize, 0, &inner->stream_channels[i]));
 			}
-
-			J40__YIELD_AFTER(j40__end_of_frame(st, &inner->toc));
-
-			J40__YIELD_AFTER(j40__inverse_transform(st, &f->gmodular));
-			if (!f->is_modular) J40__YIELD_AFTER(j40__combine_vardct(st, inner->lf_groups));
 		}
+		J40__TRY(j40__rgba_channels(st, inner->stream_channels, 3, c));
+		for (i = 0; i < f->ggcolumns; ++i) {
+			J40__TRY(j40__combine_vardct_from_lf_group(st, &row[i], inner->stream_channels, row[i].left, 0));
+			J40__TRY(j40__lf_level(st, inner, &row[i]));
+			j40__free_lf_group(&row[i]);
+		}
+	} else {
+		J40__TRY(j40__rgba_channels(st, f->gmodular.channel, f->gmodular.num_channels, c));
+	}
 
-		J40__YIELD_AFTER(j40__no_more_bytes(st));
-		break;
+	if (inner->out_width) {
+		J40__TRY(j40__stream_resized(st, inner, c, height));
+		inner->stream_y += height;
+		return 0;
+	}
 
-	default: J40__UNREACHABLE();
+	if (!inner->stream_rgba.type) {
+		J40__TRY(j40__init_plane(
+			st, J40__PLANE_U8, f->width * 4, bandsize, J40__PLANE_FORCE_PAD, &inner->stream_rgba));
+	}
+	// VarDCT bands always start at the row 0 of stream_channels
+	j40__render_rows_to_u8x4_rgba(
+		st, c, f->is_modular ? inner->stream_y : 0, f->width, height, &inner->stream_rgba);
+	J40__TRY(j40__update_levels(st, inner, &inner->stream_rgba, inner->stream_y, height));
+
+	pixels.width = f->width;
+	pixels.height = height;
+	pixels.stride_bytes = inner->stream_rgba.stride_bytes;
+	pixels.data = (void*) inner->stream_rgba.pixels;
+	err = inner->rows_func(pixels, inner->stream_y, inner->rows_data);
+	if (err) {
+		j40__set_error(st, err);
+		goto J40__ON_ERROR;
 	}
+	inner->stream_y += height;
+	if (inner->stream_y >= f->height) J40__TRY(j40__finish_levels(st, inner, c[3] != NULL));
 
-	return 0;
+J40__ON_ERROR:
+	return st->err;
 }
 
-J40_STATIC void j40__free_inner(j40__inner *inner) {
-	int64_t i, num_lf_groups = inner->frame.num_lf_groups;
-	j40__free_source(&inner->source);
-	j40__free_container(&inner->container);
-	j40__free_buffer(&inner->buffer);
-	j40__free_image_state(&inner->image);
-	j40__free_frame_state(&inner->frame);
-	if (inner->lf_groups) {
-		for (i = 0; i < num_lf_groups; ++i) j40__free_lf_group(&inner->lf_groups[i]);
-		free(inner->lf_groups);
+// box-filters rows [y0, y0 + height) of the rendered frame into pyramid levels, except for
+// the 1:8 level which may come from the LF image later (see j40__finish_levels)
+J40__STATIC_RETURNS_ERR j40__update_levels(
+	j40__st *st, j40__inner *inner, const j40__plane *rgba, int32_t y0, int32_t height
+) {
+	j40__frame_st *f = st->frame;
+	int32_t k;
+
+	for (k = 1; k < inner->nlevels; ++k) {
+		int32_t lw = (int32_t) (((int64_t) f->width + (1 << k) - 1) >> k);
+		int32_t lh = (int32_t) (((int64_t) f->height + (1 << k) - 1) >> k);
+		if (!inner->levels[k].type) {
+			J40__TRY(j40__init_plane(st, J40__PLANE_U8, lw * 4, lh, J40__PLANE_FORCE_PAD, &inner->levels[k]));
+		}
+		if (k == 3 && f->keep_lf && !f->is_modular) continue; // may be replaced anyway
+		j40__downscale_u8x4(rgba, y0, f->width, height, k, &inner->levels[k]);
 	}
-	j40__free_toc(&inner->toc);
-	j40__free_plane(&inner->rendered_rgba);
-	j40__free(inner);
-}
 
-#endif // defined J40_IMPLEMENTATION
+J40__ON_ERROR:
+	return st->err;
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// public API (implementation)
+// keeps the LF image of given LF group in `inner->lf_channels`, if requested
+J40__STATIC_RETURNS_ERR j40__lf_level(j40__st *st, j40__inner *inner, j40__lf_group_st *gg) {
+	j40__frame_st *f = st->frame;
+	int32_t i;
 
-#ifdef J40_IMPLEMENTATION
+	if (!f->keep_lf || f->is_modular) return 0;
+	if (!inner->lf_channels[0].type) {
+		int32_t w8 = j40__ceil_div32(f->width, 8), h8 = j40__ceil_div32(f->height, 8);
+		for (i = 0; i < 3; ++i) {
+			J40__TRY(j40__init_plane(st, J40__PLANE_I16, w8, h8, 0, &inner->lf_channels[i]));
+		}
+	}
+	J40__TRY(j40__lf_image_from_lf_group(st, gg, inner->lf_channels));
 
-J40_API j40_err j40_error(const j40_image *image) {
-	j40__inner *inner; // ignored
-	// do not alter image->magic even for Ufre
-	return j40__check_image((j40_image *) image, J40__ORIGIN_NONE, &inner);
+J40__ON_ERROR:
+	return st->err;
+}
+
+// combines every complete LF group directly into `inner->rendered_rgba` (non-streaming counterpart
+// of j40__stream_band), without going through intermediate I16 planes. for the resized output,
+// `inner->rendered_rgba` has the output size, so `inner->resize_src` is used instead. this is called after each
+// section, so LF groups are dequantized and transformed as soon as their last pass group arrives,
+// while others are still being read. `final` combines all remaining LF groups.
+// each LF group is released right after being combined (keeping its LF image if requested),
+// so coefficients of at most a handful of incomplete LF groups stay alive at any time.
+J40__STATIC_RETURNS_ERR j40__combine_vardct(j40__st *st, j40__inner *inner, int final) {
+	j40__frame_st *f = st->frame;
+	j40__plane *out = inner->out_width ? &inner->resize_src : &inner->rendered_rgba;
+	int64_t i;
+
+	for (i = 0; i < f->num_lf_groups; ++i) {
+		j40__lf_group_st *gg = &inner->lf_groups[i];
+		if (gg->combined) continue;
+		// the single-section frame reads its only pass group directly, so no count is kept there
+		if (!final && (!gg->loaded || gg->num_pass_groups_read < gg->grows * gg->gcolumns * f->num_passes)) {
+			continue;
+		}
+		if (!out->type) {
+			J40__SHOULD(f->width < INT32_MAX / 4, "bigg");
+			J40__TRY(j40__init_plane(st, J40__PLANE_U8, f->width * 4, f->height, J40__PLANE_FORCE_PAD, out));
+		}
+		J40__TRY(j40__combine_vardct_from_lf_group(st, gg, out, gg->left, gg->top));
+		J40__TRY(j40__lf_level(st, inner, gg));
+		j40__free_lf_group(gg);
+		gg->combined = 1;
+	}
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// completes the 1:8 level once the entire frame has been rendered. the LF image is used if
+// it's available and there is no alpha channel (which isn't part of the LF image), otherwise
+// the level is box-filtered from the rendered frame like others.
+J40__STATIC_RETURNS_ERR j40__finish_levels(j40__st *st, j40__inner *inner, int has_alpha) {
+	j40__frame_st *f = st->frame;
+	j40__plane *c[4];
+	int32_t i;
+
+	if (!f->keep_lf || f->is_modular || inner->nlevels <= 3) return 0;
+	J40__ASSERT(inner->lf_channels[0].type);
+	if (has_alpha) {
+		J40__ASSERT(inner->rendered_rgba.type); // impossible for the streaming output
+		j40__downscale_u8x4(&inner->rendered_rgba, 0, f->width, f->height, 3, &inner->levels[3]);
+	} else {
+		for (i = 0; i < 3; ++i) c[i] = &inner->lf_channels[i];
+		c[3] = NULL;
+		j40__render_rows_to_u8x4_rgba(
+			st, c, 0, inner->lf_channels[0].width, inner->lf_channels[0].height, &inner->levels[3]);
+	}
+	for (i = 0; i < 3; ++i) j40__free_plane(&inner->lf_channels[i]);
+	return 0;
+}
+
+// decides how much of the current frame should be decoded for the requested output size,
+// and prepares the resizer for that source. the LF image is used whenever 1:8 still has enough
+// resolution; otherwise progressive passes are cut as soon as their resolution suffices.
+J40__STATIC_RETURNS_ERR j40__plan_output(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	int32_t shift = 0, srcw = f->width, srch = f->height;
+
+	J40__TRY(j40__prepare_transfer(st));
+
+	f->max_passes = f->num_passes;
+	if (f->region_x1) {
+		J40__SHOULD(f->region_x1 <= f->width && f->region_y1 <= f->height, "Urgn");
+		if (!inner->rendered_rgba.type) {
+			J40__TRY(j40__init_plane(
+				st, J40__PLANE_U8, (f->region_x1 - f->region_x0) * 4, f->region_y1 - f->region_y0,
+				J40__PLANE_FORCE_PAD, &inner->rendered_rgba));
+		}
+		if (inner->tile_cache && !f->is_modular) J40__TRY(j40__fetch_tiles(st, inner));
+		return 0;
+	}
+	if (!inner->out_width) return 0;
+
+	// the largest power-of-two downsampling (up to 1:8) that is still no smaller than the output
+	while (shift < 3 && j40__ceil_div32(f->width, 2 << shift) >= inner->out_width &&
+		j40__ceil_div32(f->height, 2 << shift) >= inner->out_height) ++shift;
+	if (!f->is_modular && shift == 3) {
+		f->max_passes = 0;
+		f->keep_lf = 1;
+		srcw = j40__ceil_div32(f->width, 8);
+		srch = j40__ceil_div32(f->height, 8);
+	} else if (!f->is_modular) {
+		// passes [0, p) are enough for 1:2^log_ds[p]
+		f->max_passes = 1;
+		while (f->max_passes < f->num_passes && f->log_ds[f->max_passes] > shift) ++f->max_passes;
+	}
+
+	// this function may be called again on the failure, so only allocate what's missing
+	if (!inner->rendered_rgba.type) {
+		J40__TRY(j40__init_plane(
+			st, J40__PLANE_U8, inner->out_width * 4, inner->out_height, J40__PLANE_FORCE_PAD,
+			&inner->rendered_rgba));
+	}
+	if (!inner->resize_row.type) {
+		J40__TRY(j40__init_plane(st, J40__PLANE_U8, srcw * 4, 1, J40__PLANE_FORCE_PAD, &inner->resize_row));
+	}
+	if (!inner->resize.ring) {
+		J40__TRY(j40__init_resize(
+			st, srcw, srch, inner->out_width, inner->out_height, inner->out_filter, &inner->resize));
+	}
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// renders rows [y0, y0 + height) of `c` one at a time and feeds them to the resizer,
+// whose output rows go directly into `inner->rendered_rgba`
+J40_STATIC void j40__resize_rows(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t y0, int32_t height
+) {
+	int32_t y;
+	for (y = 0; y < height; ++y) {
+		j40__render_rows_to_u8x4_rgba(st, c, y0 + y, inner->resize.srcw, 1, &inner->resize_row);
+		j40__resize_push_row(&inner->resize, J40__U8_PIXELS(&inner->resize_row, 0), &inner->rendered_rgba);
+	}
+}
+
+// resized counterpart of the rendering in j40__stream_band, delivers any newly completed output rows
+J40__STATIC_RETURNS_ERR j40__stream_resized(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t height
+) {
+	j40__frame_st *f = st->frame;
+	int32_t dsty = inner->resize.dsty;
+	j40_pixels_u8x4 pixels;
+	j40_err err;
+
+	if (!f->is_modular && f->max_passes == 0) { // bands always start at a multiple of 8
+		int32_t ly0 = inner->stream_y >> 3;
+		j40__resize_rows(st, inner, c, ly0, j40__ceil_div32(inner->stream_y + height, 8) - ly0);
+	} else {
+		j40__resize_rows(st, inner, c, f->is_modular ? inner->stream_y : 0, height);
+	}
+
+	if (inner->resize.dsty > dsty) {
+		pixels.width = inner->out_width;
+		pixels.height = inner->resize.dsty - dsty;
+		pixels.stride_bytes = inner->rendered_rgba.stride_bytes;
+		pixels.data = (void*) J40__U8_PIXELS(&inner->rendered_rgba, dsty);
+		err = inner->rows_func(pixels, dsty, inner->rows_data);
+		if (err) {
+			j40__set_error(st, err);
+			goto J40__ON_ERROR;
+		}
+	}
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// renders the whole frame into the resized `inner->rendered_rgba` (non-streaming)
+J40__STATIC_RETURNS_ERR j40__render_resized(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	j40__plane *c[4];
+	int64_t i;
+
+	if (!f->is_modular && f->max_passes == 0) {
+		for (i = 0; i < f->num_lf_groups; ++i) J40__TRY(j40__lf_level(st, inner, &inner->lf_groups[i]));
+		J40__TRY(j40__rgba_channels(st, inner->lf_channels, 3, c));
+	} else if (!f->is_modular) { // already rendered by j40__combine_vardct, no need to convert rows
+		int32_t y;
+		J40__ASSERT(inner->resize_src.type && inner->resize.srch == f->height);
+		for (y = 0; y < f->height; ++y) {
+			j40__resize_push_row(&inner->resize, J40__U8_PIXELS(&inner->resize_src, y), &inner->rendered_rgba);
+		}
+		J40__ASSERT(inner->resize.dsty == inner->out_height);
+		j40__free_plane(&inner->resize_src);
+		return 0;
+	} else {
+		J40__TRY(j40__rgba_channels(st, f->gmodular.channel, f->gmodular.num_channels, c));
+	}
+	j40__resize_rows(st, inner, c, 0, inner->resize.srch);
+	J40__ASSERT(inner->resize.dsty == inner->out_height);
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// returns the slot pointing to the tile with given key, or the NULL slot at the end of its bucket
+J40_STATIC j40__tile **j40__tile_slot(j40_tile_cache *cache, j40__tile_key key) {
+	uint64_t h = key.image_id * 0x9e3779b97f4a7c15u ^ (uint64_t) key.gidx * 0xc2b2ae3d27d4eb4fu ^
+		(uint64_t) key.passes << 32 ^ (uint64_t) key.format ^
+		(uint64_t) key.approx_transfer << 40 ^ (uint64_t) key.fixed_point << 41;
+	j40__tile **slot = &cache->buckets[(h ^ h >> 29) % J40__TILE_BUCKETS];
+	while (*slot) {
+		j40__tile_key k = (*slot)->key;
+		if (k.image_id == key.image_id && k.gidx == key.gidx && k.passes == key.passes && k.format == key.format &&
+			k.approx_transfer == key.approx_transfer && k.fixed_point == key.fixed_point) break;
+		slot = &(*slot)->hnext;
+	}
+	return slot;
+}
+
+// removes the tile at `slot` from the cache and frees it
+J40_STATIC void j40__unlink_tile(j40_tile_cache *cache, j40__tile **slot) {
+	j40__tile *tile = *slot;
+	*slot = tile->hnext;
+	if (tile->newer) tile->newer->older = tile->older; else cache->newest = tile->older;
+	if (tile->older) tile->older->newer = tile->newer; else cache->oldest = tile->newer;
+	cache->bytes -= (size_t) tile->width * (size_t) tile->height * 4;
+	j40__free(tile->pixels);
+	j40__free(tile);
+}
+
+// looks up the tile with given key and marks it as most recently used
+J40_STATIC const j40__tile *j40__get_tile(j40_tile_cache *cache, j40__tile_key key) {
+	j40__tile *tile = *j40__tile_slot(cache, key);
+	if (!tile || tile == cache->newest) return tile;
+	tile->newer->older = tile->older;
+	if (tile->older) tile->older->newer = tile->newer; else cache->oldest = tile->newer;
+	tile->newer = NULL;
+	tile->older = cache->newest;
+	cache->newest->newer = tile;
+	cache->newest = tile;
+	return tile;
+}
+
+// copies given pixels into a new tile, evicting least recently used tiles to stay within the budget.
+// tiles larger than the entire budget are silently ignored.
+J40__STATIC_RETURNS_ERR j40__put_tile(
+	j40__st *st, j40_tile_cache *cache, j40__tile_key key, int32_t width, int32_t height,
+	const uint8_t *pixels, size_t stride_bytes
+) {
+	size_t rowbytes = (size_t) width * 4, nbytes = rowbytes * (size_t) height;
+	j40__tile **slot, *tile = NULL;
+	int32_t y;
+
+	if (nbytes > cache->budget) return 0;
+	slot = j40__tile_slot(cache, key);
+	if (*slot) j40__unlink_tile(cache, slot); // shouldn't happen unless decoded twice, but just in case
+	while (cache->bytes + nbytes > cache->budget) {
+		j40__unlink_tile(cache, j40__tile_slot(cache, cache->oldest->key));
+		++cache->evictions;
+	}
+
+	J40__TRY_CALLOC(j40__tile, &tile, 1);
+	J40__TRY_MALLOC(uint8_t, &tile->pixels, nbytes);
+	for (y = 0; y < height; ++y) memcpy(tile->pixels + rowbytes * (size_t) y, pixels + stride_bytes * (size_t) y, rowbytes);
+	tile->key = key;
+	tile->width = width;
+	tile->height = height;
+	slot = j40__tile_slot(cache, key); // evictions may have changed the bucket
+	*slot = tile;
+	tile->older = cache->newest;
+	if (cache->newest) cache->newest->newer = tile; else cache->oldest = tile;
+	cache->newest = tile;
+	cache->bytes += nbytes;
+	return 0;
+
+J40__ON_ERROR:
+	if (tile) j40__free(tile->pixels);
+	j40__free(tile);
+	return st->err;
+}
+
+// copies the part of the tile at (x, y) that intersects with the requested region into `out`
+J40_STATIC void j40__blit_tile(
+	const j40__frame_st *f, int32_t x, int32_t y, int32_t width, int32_t height,
+	const uint8_t *pixels, size_t stride_bytes, j40__plane *out
+) {
+	int32_t x0 = j40__max32(x, f->region_x0), x1 = j40__min32(x + width, f->region_x1);
+	int32_t y0 = j40__max32(y, f->region_y0), y1 = j40__min32(y + height, f->region_y1), yy;
+	for (yy = y0; yy < y1; ++yy) {
+		memcpy(J40__U8_PIXELS(out, yy - f->region_y0) + (x0 - f->region_x0) * 4,
+			pixels + stride_bytes * (size_t) (yy - y) + (size_t) (x0 - x) * 4, (size_t) (x1 - x0) * 4);
+	}
+}
+
+// copies every cached group in the region to `inner->rendered_rgba` and marks it in `tile_cached`,
+// so that it's neither decoded nor rendered again. this has to be done before decoding any group,
+// and tiles are copied right away as they can be evicted by other images sharing the cache.
+J40__STATIC_RETURNS_ERR j40__fetch_tiles(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	int32_t shift = f->group_size_shift, gx, gy;
+	j40__tile_key key;
+
+	if (f->tile_cached) return 0; // already fetched
+	J40__TRY_CALLOC(uint8_t, &f->tile_cached, (size_t) f->num_groups);
+	key.image_id = inner->tile_image_id;
+	key.passes = f->max_passes;
+	key.format = J40_U8X4;
+	key.approx_transfer = f->approx_transfer;
+	key.fixed_point = f->fixed_point;
+	for (gy = f->region_y0 >> shift; gy <= (f->region_y1 - 1) >> shift; ++gy) {
+		for (gx = f->region_x0 >> shift; gx <= (f->region_x1 - 1) >> shift; ++gx) {
+			struct j40__group_info info;
+			const j40__tile *tile;
+			key.gidx = (int64_t) gy * f->gcolumns + gx;
+			info = j40__group_info(f, key.gidx);
+			tile = j40__get_tile(inner->tile_cache, key);
+			if (!tile || tile->width != info.gw || tile->height != info.gh) {
+				++inner->tile_cache->misses;
+				continue;
+			}
+			++inner->tile_cache->hits;
+			j40__blit_tile(f, gx << shift, gy << shift, info.gw, info.gh,
+				tile->pixels, (size_t) tile->width * 4, &inner->rendered_rgba);
+			f->tile_cached[key.gidx] = 1;
+		}
+	}
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// tile cache counterpart of the row-wise copy in j40__render_region. each row of groups with
+// any newly decoded group is rendered at once, and those groups are cached and copied to the output.
+// `c` covers frame columns [left, left + width) and rows from `top`.
+J40__STATIC_RETURNS_ERR j40__render_tiles(
+	j40__st *st, j40__inner *inner, j40__plane *const c[4], int32_t left, int32_t top, int32_t width
+) {
+	j40__frame_st *f = st->frame;
+	int32_t shift = f->group_size_shift, gx, gy, gx0 = f->region_x0 >> shift, gx1 = (f->region_x1 - 1) >> shift;
+	j40__plane band = J40__INIT;
+	j40__tile_key key;
+
+	J40__TRY(j40__init_plane(st, J40__PLANE_U8, width * 4, 1 << shift, J40__PLANE_FORCE_PAD, &band));
+	key.image_id = inner->tile_image_id;
+	key.passes = f->max_passes;
+	key.format = J40_U8X4;
+	key.approx_transfer = f->approx_transfer;
+	key.fixed_point = f->fixed_point;
+	for (gy = f->region_y0 >> shift; gy <= (f->region_y1 - 1) >> shift; ++gy) {
+		int rendered = 0;
+		for (gx = gx0; gx <= gx1; ++gx) {
+			struct j40__group_info info;
+			const uint8_t *pixels;
+			key.gidx = (int64_t) gy * f->gcolumns + gx;
+			if (f->tile_cached[key.gidx]) continue;
+			info = j40__group_info(f, key.gidx);
+			if (!rendered) {
+				j40__render_rows_to_u8x4_rgba(st, c, (gy << shift) - top, width, info.gh, &band);
+				rendered = 1;
+			}
+			pixels = J40__U8_PIXELS(&band, 0) + ((gx << shift) - left) * 4;
+			j40__blit_tile(f, gx << shift, gy << shift, info.gw, info.gh, pixels, (size_t) band.stride_bytes,
+				&inner->rendered_rgba);
+			J40__TRY(j40__put_tile(st, inner->tile_cache, key, info.gw, info.gh, pixels, (size_t) band.stride_bytes));
+		}
+	}
+
+J40__ON_ERROR:
+	j40__free_plane(&band);
+	return st->err;
+}
+
+// renders the requested region into `inner->rendered_rgba` (non-streaming). for VarDCT, only LF groups
+// intersecting with the region are combined, into planes just covering those LF groups.
+J40__STATIC_RETURNS_ERR j40__render_region(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	int32_t ggsize = 8 << f->group_size_shift, left = 0, top = 0, width = f->width, height = f->height;
+	int32_t rw = f->region_x1 - f->region_x0, y;
+	j40__plane channels[3] = {J40__INIT}, row = J40__INIT, *c[4];
+	int64_t i;
+
+	if (!f->is_modular) {
+		left = f->region_x0 / ggsize * ggsize;
+		top = f->region_y0 / ggsize * ggsize;
+		width = j40__min32(j40__ceil_div32(f->region_x1, ggsize) * ggsize, f->width) - left;
+		height = j40__min32(j40__ceil_div32(f->region_y1, ggsize) * ggsize, f->height) - top;
+		for (i = 0; i < 3; ++i) {
+			J40__TRY(j40__init_plane(st, J40__PLANE_I16, width, height, J40__PLANE_FORCE_PAD, &channels[i]));
+		}
+		for (i = 0; i < f->num_lf_groups; ++i) {
+			j40__lf_group_st *gg = &inner->lf_groups[i];
+			if (!j40__lf_group_in_region(f, gg)) continue;
+			J40__TRY(j40__combine_vardct_from_lf_group(st, gg, channels, gg->left - left, gg->top - top));
+			j40__free_lf_group(gg);
+		}
+		J40__TRY(j40__rgba_channels(st, channels, 3, c));
+	} else {
+		J40__TRY(j40__rgba_channels(st, f->gmodular.channel, f->gmodular.num_channels, c));
+	}
+
+	if (f->tile_cached) {
+		J40__TRY(j40__render_tiles(st, inner, c, left, top, width));
+	} else {
+		J40__TRY(j40__init_plane(st, J40__PLANE_U8, width * 4, 1, J40__PLANE_FORCE_PAD, &row));
+		for (y = f->region_y0; y < f->region_y1; ++y) {
+			j40__render_rows_to_u8x4_rgba(st, c, y - top, width, 1, &row);
+			memcpy(J40__U8_PIXELS(&inner->rendered_rgba, y - f->region_y0),
+				J40__U8_PIXELS(&row, 0) + (f->region_x0 - left) * 4, (size_t) rw * 4);
+		}
+	}
+
+J40__ON_ERROR:
+	for (i = 0; i < 3; ++i) j40__release_plane(st->pool, &channels[i]);
+	j40__free_plane(&row);
+	return st->err;
+}
+
+// makes the current frame shareable. attached decoders should never modify the shared state,
+// so everything that would be otherwise lazily prepared by LF groups is prepared in advance.
+J40__STATIC_RETURNS_ERR j40__prepare_shared(j40__st *st, const j40__toc *toc) {
+	j40__frame_st *f = st->frame;
+
+	J40__SHOULD(!f->is_modular && f->gmodular.num_channels == 0,
+		"TODO: only VarDCT frames without extra channels can be shared");
+	J40__SHOULD(!toc->single_size, "TODO: frames with a single section can't be shared");
+
+	f->dct_select_used = (1 << J40__NUM_DCT_SELECT) - 1;
+	f->order_used = (1 << J40__NUM_ORDERS) - 1;
+	J40__TRY(j40__prepare_dq_matrices(st));
+	J40__TRY(j40__prepare_orders(st));
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// sets `inner` up so that j40__advance continues right after HfGlobal of `shared`
+J40__STATIC_RETURNS_ERR j40__attach_shared(j40__st *st, j40__inner *inner, struct j40_shared *shared) {
+	J40__TRY(j40__init_memory_source(st, shared->buf, shared->size, NULL, &inner->source));
+	inner->container = shared->container;
+	inner->container.map = NULL;
+	J40__TRY_MALLOC(j40__map, &inner->container.map, (size_t) shared->container.map_cap);
+	memcpy(inner->container.map, shared->container.map, sizeof(j40__map) * (size_t) shared->container.nmap);
+	J40__TRY(j40__init_buffer(st, 0, INT64_MAX));
+
+	// nothing can fail from now on
+	inner->image = shared->image;
+	inner->frame = shared->frame;
+	memset(&inner->frame.gmodular, 0, sizeof(j40__modular)); // always empty, but will be used later
+	inner->toc = shared->toc;
+	inner->state = inner->start_state = shared->state;
+	inner->shared = shared;
+	(void) J40__ATOMIC_ADD(&shared->refcount, 1);
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+J40_STATIC void j40__release_shared(struct j40_shared *shared) {
+	if (J40__ATOMIC_ADD(&shared->refcount, -1) > 0) return;
+	j40__free_container(&shared->container);
+	j40__free_image_state(&shared->image);
+	j40__free_frame_state(&shared->frame);
+	j40__free_toc(&shared->toc);
+	if (shared->freefunc) shared->freefunc(shared->buf);
+	j40__free(shared);
+}
+
+// can be chained: j40__crc32(j40__crc32(0, a, m), b, n) == CRC-32 of a and b concatenated
+J40_STATIC uint32_t j40__crc32(uint32_t crc, const uint8_t *p, size_t n) {
+	int i;
+	crc = ~crc;
+	while (n--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; ++i) crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+	}
+	return ~crc;
+}
+
+// fingerprints the image for the TOC index: CRC-32 of the TOC bytes [start_codeoff, data_codeoff),
+// read directly from the source. this doesn't disturb st->buffer, which always seeks before reading.
+// also makes sure that the source does extend to the end of the frame.
+J40__STATIC_RETURNS_ERR j40__toc_crc32(j40__st *st, const j40__toc *toc, uint32_t *out) {
+	const j40__container_st *c = st->container;
+	uint8_t buf[1024];
+	int64_t codeoff = toc->start_codeoff, fileoff, size;
+	uint32_t crc = 0;
+	int32_t i;
+
+	while (codeoff < toc->data_codeoff) {
+		i = j40__search_codestream_offset(st, codeoff);
+		size = j40__min64(toc->data_codeoff - codeoff, (int64_t) sizeof(buf));
+		if (i < c->nmap - 1) size = j40__min64(size, c->map[i+1].codeoff - codeoff); // don't cross boxes
+		J40__TRY(j40__map_codestream_offset(st, codeoff, &fileoff));
+		J40__TRY(j40__seek_from_source(st, fileoff));
+		J40__TRY(j40__read_from_source(st, buf, size));
+		crc = j40__crc32(crc, buf, (size_t) size);
+		codeoff += size;
+	}
+
+	J40__ASSERT(toc->end_codeoff > toc->data_codeoff);
+	J40__TRY(j40__map_codestream_offset(st, toc->end_codeoff - 1, &fileoff));
+	J40__TRY(j40__seek_from_source(st, fileoff));
+	J40__TRY(j40__try_read_from_source(st, buf, 0, 1, &size));
+	J40__SHOULD(size == 1, "Uidx");
+
+	*out = crc;
+J40__ON_ERROR:
+	return st->err;
+}
+
+// TOC index format (all integers are little endian):
+// - 80-byte header:
+//   "J40I", u32 version (2), u32 container flags, u32 nmap,
+//   i64 toc.start_bits, i64 toc.data_codeoff, i64 toc.end_codeoff,
+//   u32 toc.single_size, u32 toc.lf_global_size, i64 toc.lf_global_codeoff,
+//   u32 toc.hf_global_size, u32 TOC fingerprint (see j40__toc_crc32), i64 toc.hf_global_codeoff,
+//   i64 toc.nsections
+// - nmap container map entries: i64 codeoff, i64 fileoff
+// - nsections sections in the TOC order: i64 idx, i64 codeoff, i32 size, i32 pass
+// - u32 CRC-32 of everything above
+#define J40__INDEX_VERSION 2
+#define J40__INDEX_HEADER_SIZE 80
+
+J40_ALWAYS_INLINE uint8_t *j40__put32le(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t) v; p[1] = (uint8_t) (v >> 8); p[2] = (uint8_t) (v >> 16); p[3] = (uint8_t) (v >> 24);
+	return p + 4;
+}
+
+J40_ALWAYS_INLINE uint8_t *j40__put64le(uint8_t *p, int64_t v) {
+	p = j40__put32le(p, (uint32_t) ((uint64_t) v & 0xffffffffu));
+	return j40__put32le(p, (uint32_t) ((uint64_t) v >> 32));
+}
+
+J40_ALWAYS_INLINE uint32_t j40__get32le(const uint8_t **p) {
+	const uint8_t *q = *p;
+	*p += 4;
+	return (uint32_t) q[0] | (uint32_t) q[1] << 8 | (uint32_t) q[2] << 16 | (uint32_t) q[3] << 24;
+}
+
+J40_ALWAYS_INLINE int64_t j40__get64le(const uint8_t **p) {
+	uint64_t lo = j40__get32le(p);
+	return (int64_t) (lo | (uint64_t) j40__get32le(p) << 32);
+}
+
+J40__STATIC_RETURNS_ERR j40__save_index(j40__st *st, const j40__inner *inner, uint8_t **out, size_t *outsize) {
+	const j40__container_st *c = &inner->container;
+	const j40__toc *toc = &inner->toc;
+	uint8_t *buf = NULL, *p;
+	size_t size;
+	int64_t i;
+	uint32_t fingerprint;
+
+	// make sure that the whole frame is mapped, so that the loaded map never has to grow
+	J40__TRY(j40__container(st, toc->end_codeoff));
+	J40__TRY(j40__toc_crc32(st, toc, &fingerprint));
+
+	size = J40__INDEX_HEADER_SIZE + (size_t) c->nmap * 16 + (size_t) toc->nsections * 24 + 4;
+	J40__TRY_MALLOC(uint8_t, &buf, size);
+	p = buf;
+	memcpy(p, "J40I", 4); p += 4;
+	p = j40__put32le(p, J40__INDEX_VERSION);
+	p = j40__put32le(p, (uint32_t) c->flags);
+	p = j40__put32le(p, (uint32_t) c->nmap);
+	p = j40__put64le(p, toc->start_bits);
+	p = j40__put64le(p, toc->data_codeoff);
+	p = j40__put64le(p, toc->end_codeoff);
+	p = j40__put32le(p, (uint32_t) toc->single_size);
+	p = j40__put32le(p, (uint32_t) toc->lf_global_size);
+	p = j40__put64le(p, toc->lf_global_codeoff);
+	p = j40__put32le(p, (uint32_t) toc->hf_global_size);
+	p = j40__put32le(p, fingerprint);
+	p = j40__put64le(p, toc->hf_global_codeoff);
+	p = j40__put64le(p, toc->nsections);
+	for (i = 0; i < c->nmap; ++i) {
+		p = j40__put64le(p, c->map[i].codeoff);
+		p = j40__put64le(p, c->map[i].fileoff);
+	}
+	for (i = 0; i < toc->nsections; ++i) {
+		p = j40__put64le(p, toc->sections[i].idx);
+		p = j40__put64le(p, toc->sections[i].codeoff);
+		p = j40__put32le(p, (uint32_t) toc->sections[i].size);
+		p = j40__put32le(p, (uint32_t) toc->sections[i].pass);
+	}
+	p = j40__put32le(p, j40__crc32(0, buf, size - 4));
+	J40__ASSERT(p == buf + size);
+
+	*out = buf;
+	*outsize = size;
+	return 0;
+
+J40__ON_ERROR:
+	j40__free(buf);
+	return st->err;
+}
+
+// parses and validates the TOC index as far as possible without the frame header,
+// the remainder is checked by j40__toc_from_index
+J40__STATIC_RETURNS_ERR j40__load_index(j40__st *st, j40__inner *inner, const uint8_t *p, size_t size) {
+	const uint8_t *end = p + size, *crcp;
+	j40__container_st c = J40__INIT;
+	j40__toc toc = J40__INIT;
+	int64_t i, nsections;
+	uint32_t nmap, fingerprint;
+
+	J40__SHOULD(size >= J40__INDEX_HEADER_SIZE + 4 && memcmp(p, "J40I", 4) == 0, "Uidx");
+	crcp = end - 4;
+	J40__SHOULD(j40__get32le(&crcp) == j40__crc32(0, p, size - 4), "Uidx");
+	p += 4;
+	J40__SHOULD(j40__get32le(&p) == J40__INDEX_VERSION, "Uidx");
+	c.flags = (int) j40__get32le(&p);
+	nmap = j40__get32le(&p);
+	toc.start_bits = j40__get64le(&p);
+	toc.data_codeoff = j40__get64le(&p);
+	toc.end_codeoff = j40__get64le(&p);
+	toc.single_size = (int32_t) j40__get32le(&p);
+	toc.lf_global_size = (int32_t) j40__get32le(&p);
+	toc.lf_global_codeoff = j40__get64le(&p);
+	toc.hf_global_size = (int32_t) j40__get32le(&p);
+	fingerprint = j40__get32le(&p);
+	toc.hf_global_codeoff = j40__get64le(&p);
+	nsections = j40__get64le(&p);
+
+	// bound both counts by the remaining size first, so that the size check below can't wrap around
+	J40__SHOULD(0 < nmap && nmap <= (uint32_t) INT32_MAX && (uint64_t) nmap <= (uint64_t) (end - p - 4) / 16, "Uidx");
+	J40__SHOULD(0 <= nsections && nsections <= INT32_MAX && nsections <= (int64_t) ((end - p - 4) / 24), "Uidx");
+	J40__SHOULD((uint64_t) nmap * 16 + (uint64_t) nsections * 24 == (uint64_t) (end - p - 4), "Uidx");
+	J40__SHOULD(0 <= toc.data_codeoff && toc.data_codeoff <= toc.end_codeoff, "Uidx");
+	J40__SHOULD(toc.single_size >= 0 && toc.lf_global_size >= 0 && toc.hf_global_size >= 0, "Uidx");
+	if (toc.single_size) {
+		J40__SHOULD(toc.end_codeoff - toc.data_codeoff == toc.single_size, "Uidx");
+	} else {
+		int64_t lf_global_end, hf_global_end;
+		J40__SHOULD(toc.lf_global_codeoff >= toc.data_codeoff && toc.hf_global_codeoff >= toc.data_codeoff, "Uidx");
+		J40__SHOULD(j40__add64(toc.lf_global_codeoff, toc.lf_global_size, &lf_global_end), "Uidx");
+		J40__SHOULD(j40__add64(toc.hf_global_codeoff, toc.hf_global_size, &hf_global_end), "Uidx");
+		J40__SHOULD(lf_global_end <= toc.end_codeoff && hf_global_end <= toc.end_codeoff, "Uidx");
+	}
+
+	c.nmap = c.map_cap = (int32_t) nmap;
+	J40__TRY_MALLOC(j40__map, &c.map, (size_t) nmap);
+	for (i = 0; i < c.nmap; ++i) {
+		c.map[i].codeoff = j40__get64le(&p);
+		c.map[i].fileoff = j40__get64le(&p);
+		J40__SHOULD(c.map[i].codeoff >= 0 && c.map[i].fileoff >= 0, "Uidx");
+		J40__SHOULD(i == 0 || (c.map[i-1].codeoff <= c.map[i].codeoff && c.map[i-1].fileoff <= c.map[i].fileoff), "Uidx");
+	}
+
+	toc.nsections = nsections;
+	if (nsections > 0) J40__TRY_MALLOC(j40__section, &toc.sections, (size_t) nsections);
+	for (i = 0; i < nsections; ++i) {
+		j40__section *sec = &toc.sections[i];
+		int64_t secend;
+		sec->idx = j40__get64le(&p);
+		sec->codeoff = j40__get64le(&p);
+		sec->size = (int32_t) j40__get32le(&p);
+		sec->pass = (int32_t) j40__get32le(&p);
+		J40__SHOULD(sec->idx >= 0 && sec->size >= 0 && sec->codeoff >= toc.data_codeoff, "Uidx");
+		J40__SHOULD(j40__add64(sec->codeoff, sec->size, &secend) && secend <= toc.end_codeoff, "Uidx");
+	}
+
+	inner->container = c;
+	inner->index_toc = toc;
+	inner->index_fingerprint = fingerprint;
+	inner->has_index = 1;
+	return 0;
+
+J40__ON_ERROR:
+	j40__free_container(&c);
+	j40__free_toc(&toc);
+	return st->err;
+}
+
+// replaces j40__read_toc when the TOC index has been loaded. the loaded sections are put back
+// into the unpermuted TOC layout, which also ensures that they form a complete permutation,
+// and then reordered exactly as j40__read_toc would do.
+J40__STATIC_RETURNS_ERR j40__toc_from_index(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	j40__toc *toc = &inner->index_toc;
+	int64_t nsections = f->num_passes == 1 && f->num_groups == 1 ? 0 :
+		f->num_lf_groups + (int64_t) f->num_passes * f->num_groups; // excludes LfGlobal and HfGlobal
+	j40__section *sections = NULL;
+	int64_t i;
+	uint32_t fingerprint;
+
+	J40__SHOULD(j40__bits_read(st) == toc->start_bits, "Uidx");
+	toc->start_codeoff = j40__bits_codeoff(st);
+	J40__TRY(j40__toc_crc32(st, toc, &fingerprint));
+	J40__SHOULD(fingerprint == inner->index_fingerprint, "Uidx");
+	J40__SHOULD(!toc->single_size == (nsections > 0) && toc->nsections == nsections, "Uidx");
+	if (nsections > 0) {
+		J40__SHOULD((uint64_t) nsections + 2 <= SIZE_MAX && nsections + 2 <= INT32_MAX, "flen");
+		J40__TRY_MALLOC(j40__section, &sections, (size_t) (nsections + 2));
+		for (i = 0; i < nsections + 2; ++i) sections[i].codeoff = -1; // marks an unfilled slot
+		for (i = 0; i < nsections; ++i) {
+			const j40__section *sec = &toc->sections[i];
+			int64_t slot;
+			if (sec->pass < 0) {
+				J40__SHOULD(sec->pass == -1 && sec->idx < f->num_lf_groups, "Uidx");
+				slot = 1 + sec->idx;
+			} else {
+				J40__SHOULD(sec->pass < f->num_passes && sec->idx < f->num_groups, "Uidx");
+				slot = 1 + f->num_lf_groups + 1 + (int64_t) sec->pass * f->num_groups + sec->idx;
+			}
+			J40__SHOULD(sections[slot].codeoff < 0, "Uidx"); // no duplicates, hence no gaps
+			sections[slot] = *sec;
+		}
+		j40__free_toc(toc);
+		J40__TRY(j40__order_sections(st, sections, toc));
+		j40__free(sections);
+		sections = NULL;
+	}
+	J40__TRY(j40__seek_buffer(st, toc->data_codeoff));
+
+	inner->toc = *toc;
+	inner->toc.nsections_read = inner->toc.nsections_prefetched = 0;
+	memset(toc, 0, sizeof(j40__toc));
+
+J40__ON_ERROR:
+	j40__free(sections);
+	return st->err;
+}
+
+// builds all pyramid levels from the fully rendered frame (non-streaming counterpart of j40__stream_band)
+J40__STATIC_RETURNS_ERR j40__render_levels(j40__st *st, j40__inner *inner) {
+	j40__frame_st *f = st->frame;
+	j40__plane *c[4];
+	int64_t i;
+	int has_alpha = 0; // VarDCT frames are rendered without alpha (see j40__combine_vardct)
+
+	if (f->is_modular) {
+		J40__TRY(j40__rgba_channels(st, f->gmodular.channel, f->gmodular.num_channels, c));
+		has_alpha = c[3] != NULL;
+	} else if (f->keep_lf) {
+		for (i = 0; i < f->num_lf_groups; ++i) {
+			// combined LF groups have already been released after j40__lf_level
+			if (!inner->lf_groups[i].combined) J40__TRY(j40__lf_level(st, inner, &inner->lf_groups[i]));
+		}
+	}
+	J40__TRY(j40__update_levels(st, inner, &inner->rendered_rgba, 0, f->height));
+	J40__TRY(j40__finish_levels(st, inner, has_alpha));
+
+J40__ON_ERROR:
+	return st->err;
+}
+
+// returns true only once, when all LF groups of the current frame have been loaded
+J40_STATIC int j40__lf_event_pending(j40__inner *inner) {
+	int64_t i;
+	if (inner->lf_event_done) return 0;
+	for (i = 0; i < inner->frame.num_lf_groups; ++i) {
+		if (!inner->lf_groups[i].loaded) return 0;
+	}
+	inner->lf_event_done = 1;
+	return 1;
+}
+
+// TODO expose this with a proper interface
+J40__STATIC_RETURNS_ERR j40__advance(j40__inner *inner, j40__origin origin/*, int32_t until*/) {
+	j40__st stbuf, *st = &stbuf;
+	j40__frame_st *f;
+	j40_err err;
+
+	j40__init_state(st, inner);
+
+	// a less-known coroutine hack with some tweak.
+	// see https://www.chiark.greenend.org.uk/~sgtatham/coroutines.html for basic concepts.
+	//
+	// it is EXTREMELY important that any `J40__YIELD_AFTER` call may fail, and the next call
+	// to `j40_advance` will restart after the last successful `J40__YIELD_AFTER` call.
+	// therefore any code between two `J40__YIELD_AFTER` can run multiple times!
+	// if you don't want this, you should move the code into a separate function.
+	// for the same reason, this block can't contain any variable declaration or assignment.
+	#define J40__YIELD_AFTER(expr) \
+		do { \
+			err = (expr); \
+			j40__save_state(st, inner, origin); \
+			if (err) return err; \
+			inner->state = __LINE__; /* thus each line can have at most one J40__YIELD() call */ \
+			/* fall through */ \
+			case __LINE__:; \
+		} while (0)
+
+	// returns `ev` to j40_next_event if requested, and resumes from here in the next call
+	#define J40__YIELD_EVENT(ev) \
+		do { \
+			inner->state = __LINE__; \
+			if (inner->want_events) { \
+				inner->event = (ev); \
+				return 0; \
+			} \
+			/* fall through */ \
+			case __LINE__:; \
+		} while (0)
+
+	f = st->frame;
+	switch (inner->state) {
+	case 0: // initial state
+
+		J40__YIELD_AFTER(j40__init_buffer(st, 0, INT64_MAX));
+		J40__YIELD_AFTER(j40__signature(st));
+		J40__YIELD_AFTER(j40__image_metadata(st));
+
+		if (st->image->want_icc) {
+			J40__YIELD_AFTER(j40__icc(st));
+		}
+		J40__YIELD_EVENT(J40_EVENT_HEADER);
+
+		{ // TODO should really be a loop, should we support multiple frames
+			J40__YIELD_AFTER(j40__frame_header(st));
+			if (!f->is_last) J40__YIELD_AFTER(J40__ERR("TODO: multiple frames"));
+			if (f->type != J40__FRAME_REGULAR) J40__YIELD_AFTER(J40__ERR("TODO: non-regular frame"));
+			J40__YIELD_AFTER(inner->has_index ? j40__toc_from_index(st, inner) : j40__read_toc(st, &inner->toc));
+			j40__prefetch_sections(st, &inner->toc);
+
+			J40__YIELD_AFTER(j40__lf_global_in_section(st, &inner->toc));
+			J40__YIELD_AFTER(j40__hf_global_in_section(st, &inner->toc));
+			if (inner->sharing) {
+				J40__YIELD_AFTER(j40__prepare_shared(st, &inner->toc));
+				J40__YIELD_EVENT(J40__EVENT_SHARED); // decoders attached to j40_shared start from here
+			}
+
+			J40__YIELD_AFTER(j40__plan_output(st, inner));
+
+			J40__YIELD_AFTER(j40__allocate_lf_groups(st, &inner->lf_groups));
+
+			if (inner->toc.single_size) {
+				J40__ASSERT(f->num_lf_groups == 1 && f->num_groups == 1 && f->num_passes == 1);
+				J40__YIELD_AFTER(j40__lf_group(st, &inner->lf_groups[0]));
+				if (j40__lf_event_pending(inner)) J40__YIELD_EVENT(J40_EVENT_LF);
+				J40__YIELD_AFTER(j40__prepare_dq_matrices(st));
+				J40__YIELD_AFTER(j40__prepare_orders(st));
+				if (f->max_passes > 0) {
+					J40__YIELD_AFTER(j40__pass_group(st, 0, 0, 0, f->width, f->height, 0, &inner->lf_groups[0]));
+				} else { // only the LF image is needed (see j40__plan_output), skip the rest of the section
+					J40__YIELD_AFTER(j40__seek_buffer(st, inner->toc.end_codeoff));
+				}
+				J40__YIELD_AFTER(j40__zero_pad_to_byte(st));
+			} else {
+				while (inner->toc.nsections_read < inner->toc.nsections) {
+					J40__YIELD_AFTER(j40__lf_or_pass_group_in_section(st, &inner->toc, inner->lf_groups));
+					if (j40__lf_event_pending(inner)) J40__YIELD_EVENT(J40_EVENT_LF);
+					if (!inner->rows_func && !f->is_modular && f->max_passes > 0 && !f->region_x1) {
+						J40__YIELD_AFTER(j40__combine_vardct(st, inner, 0));
+					}
+					while (j40__band_ready(inner, 0)) {
+						J40__YIELD_AFTER(j40__stream_band(st, inner, 0));
+						J40__YIELD_EVENT(J40_EVENT_ROWS);
+					}
+				}
+			}
+
+			J40__YIELD_AFTER(j40__end_of_frame(st, &inner->toc));
+
+			J40__YIELD_AFTER(j40__inverse_transform(st, &f->gmodular));
+			if (inner->rows_func) {
+				while (j40__band_ready(inner, 1)) {
+					J40__YIELD_AFTER(j40__stream_band(st, inner, 1));
+					J40__YIELD_EVENT(J40_EVENT_ROWS);
+				}
+			} else if (!f->is_modular && f->max_passes > 0 && !f->region_x1) {
+				J40__YIELD_AFTER(j40__combine_vardct(st, inner, 1));
+			}
+		}
+
+		J40__YIELD_AFTER(j40__no_more_bytes(st));
+		J40__YIELD_EVENT(J40_EVENT_FRAME);
+		break;
+
+	default: J40__UNREACHABLE();
+	}
+
+	return 0;
+}
+
+J40_STATIC void j40__reset_inner(j40__inner *inner) {
+	int64_t i, num_lf_groups = inner->frame.num_lf_groups;
+	j40__pool_st pool;
+	j40__free_source(&inner->source);
+	j40__free_container(&inner->container);
+	j40__free_buffer(&inner->buffer);
+	if (inner->shared) {
+		j40__free_modular(&inner->frame.gmodular);
+		j40__free(inner->frame.tile_cached);
+		j40__free(inner->frame.transfer_lut);
+		j40__free(inner->frame.transfer_lut8);
+		j40__release_shared(inner->shared);
+	} else {
+		j40__free_image_state(&inner->image);
+		j40__free_frame_state(&inner->frame);
+		j40__free_toc(&inner->toc);
+	}
+	if (inner->lf_groups) {
+		for (i = 0; i < num_lf_groups; ++i) j40__free_lf_group(&inner->lf_groups[i]);
+		free(inner->lf_groups);
+	}
+	j40__free_plane(&inner->rendered_rgba);
+	for (i = 0; i < 3; ++i) j40__free_plane(&inner->stream_channels[i]);
+	j40__free_plane(&inner->stream_rgba);
+	for (i = 0; i < J40_MAX_LEVELS; ++i) j40__free_plane(&inner->levels[i]);
+	for (i = 0; i < 3; ++i) j40__free_plane(&inner->lf_channels[i]);
+	j40__free_resize(&inner->resize);
+	j40__free_plane(&inner->resize_row);
+	j40__free_plane(&inner->resize_src);
+	j40__free_toc(&inner->index_toc);
+
+	pool = inner->pool;
+	memset(inner, 0, sizeof(j40__inner));
+	inner->pool = pool;
+}
+
+J40_STATIC void j40__free_inner(j40__inner *inner) {
+	j40__reset_inner(inner);
+	j40__free_pool(&inner->pool);
+	j40__free(inner);
+}
+
+#endif // defined J40_IMPLEMENTATION
+
+////////////////////////////////////////////////////////////////////////////////
+// public API (implementation)
+
+#ifdef J40_IMPLEMENTATION
+
+J40_API j40_err j40_error(const j40_image *image) {
+	j40__inner *inner; // ignored
+	// do not alter image->magic even for Ufre
+	return j40__check_image((j40_image *) image, J40__ORIGIN_NONE, &inner);
 }
 
 J40_API const char *j40_error_string(const j40_image *image) {
@@ -8360,6 +10537,172 @@ J40_API j40_err j40_from_file(j40_image *image, const char *path) {
 	}
 }
 
+J40_API j40_err j40_from_shared(j40_image *image, j40_shared *shared) {
+	static const j40__origin ORIGIN = J40__ORIGIN_from_shared;
+	j40__inner *inner;
+	j40__st stbuf, *st = &stbuf;
+
+	if (!image) return J40__4("Uim0");
+	if (!shared) return j40__set_alt_magic(J40__4("Ush0"), 0, ORIGIN, image);
+
+	inner = (j40__inner*) j40__calloc(1, sizeof(j40__inner));
+	if (!inner) return j40__set_alt_magic(J40__4("!mem"), 0, ORIGIN, image);
+
+	j40__init_state(st, inner);
+	if (j40__attach_shared(st, inner, shared)) {
+		j40__free_inner(inner);
+		return j40__set_alt_magic(st->err, st->saved_errno, ORIGIN, image);
+	} else {
+		J40__ASSERT(!st->err);
+		return j40__set_magic(inner, image);
+	}
+}
+
+J40_API j40_err j40_shared_from_memory(
+	j40_shared **shared, void *buf, size_t size, j40_memory_free_func freefunc
+) {
+	j40__inner *inner = NULL;
+	j40_shared *sh = NULL;
+	j40__st stbuf, *st = &stbuf;
+	j40_err err;
+
+	if (!shared) return J40__4("Ush0");
+	*shared = NULL;
+	if (!buf) return J40__4("Ubf0");
+
+	inner = (j40__inner*) j40__calloc(1, sizeof(j40__inner));
+	sh = (j40_shared*) j40__calloc(1, sizeof(j40_shared));
+	if (!inner || !sh) {
+		err = J40__4("!mem");
+		goto J40__ON_ERROR;
+	}
+
+	j40__init_state(st, inner);
+	err = j40__init_memory_source(st, (uint8_t*) buf, size, NULL, &inner->source);
+	inner->sharing = inner->want_events = 1;
+	while (!err) { // skip any other events until HfGlobal
+		inner->event = 0;
+		err = j40__advance(inner, J40__ORIGIN_NONE);
+		if (!err && inner->event == J40__EVENT_SHARED) break;
+		if (!err && !inner->event) err = J40__4("shrt"); // can't happen, but just in case
+	}
+	if (err) goto J40__ON_ERROR;
+
+	// move everything needed by attached decoders out of `inner`
+	sh->refcount = 1;
+	sh->buf = (uint8_t*) buf;
+	sh->size = size;
+	sh->freefunc = freefunc;
+	sh->container = inner->container;
+	sh->image = inner->image;
+	sh->frame = inner->frame;
+	sh->toc = inner->toc;
+	sh->state = inner->state;
+	memset(&inner->container, 0, sizeof(j40__container_st));
+	memset(&inner->image, 0, sizeof(j40__image_st));
+	memset(&inner->frame, 0, sizeof(j40__frame_st));
+	memset(&inner->toc, 0, sizeof(j40__toc));
+	j40__free_inner(inner);
+	*shared = sh;
+	return 0;
+
+J40__ON_ERROR:
+	if (inner) j40__free_inner(inner);
+	j40__free(sh);
+	return err;
+}
+
+J40_API void j40_free_shared(j40_shared *shared) {
+	if (shared) j40__release_shared(shared);
+}
+
+J40_API j40_err j40_save_toc_index(j40_image *image, void **data, size_t *size) {
+	static const j40__origin ORIGIN = J40__ORIGIN_save_toc_index;
+	j40__inner *inner;
+	j40__st stbuf;
+	uint8_t *buf;
+	j40_err err;
+
+	J40__CHECK_IMAGE();
+
+	if (!data || !size) return J40__SET_INNER_ERR("Ubf0");
+	*data = NULL;
+	*size = 0;
+	if (!inner->toc.end_codeoff) return J40__SET_INNER_ERR("Uidn"); // TOC is not yet read
+
+	j40__init_state(&stbuf, inner);
+	err = j40__save_index(&stbuf, inner, &buf, size);
+	if (err) {
+		inner->origin = ORIGIN;
+		inner->err = err;
+		return err;
+	}
+	*data = buf;
+	return 0;
+}
+
+J40_API void j40_free_toc_index(void *data) {
+	j40__free(data);
+}
+
+J40_API j40_tile_cache *j40_new_tile_cache(size_t budget) {
+	j40_tile_cache *cache = (j40_tile_cache*) j40__calloc(1, sizeof(j40_tile_cache));
+	if (cache) cache->budget = budget;
+	return cache;
+}
+
+J40_API void j40_free_tile_cache(j40_tile_cache *cache) {
+	if (!cache) return;
+	while (cache->oldest) j40__unlink_tile(cache, j40__tile_slot(cache, cache->oldest->key));
+	j40__free(cache);
+}
+
+J40_API j40_tile_cache_stats j40_tile_cache_get_stats(const j40_tile_cache *cache) {
+	j40_tile_cache_stats stats = J40__INIT;
+	if (cache) {
+		stats.hits = cache->hits;
+		stats.misses = cache->misses;
+		stats.evictions = cache->evictions;
+		stats.bytes = cache->bytes;
+	}
+	return stats;
+}
+
+J40_API j40_err j40_use_tile_cache(j40_image *image, j40_tile_cache *cache, uint64_t image_id) {
+	static const j40__origin ORIGIN = J40__ORIGIN_use_tile_cache;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat"); // groups may have been already read
+
+	inner->tile_cache = cache;
+	inner->tile_image_id = image_id;
+	return 0;
+}
+
+J40_API j40_err j40_load_toc_index(j40_image *image, const void *data, size_t size) {
+	static const j40__origin ORIGIN = J40__ORIGIN_load_toc_index;
+	j40__inner *inner;
+	j40__st stbuf;
+	j40_err err;
+
+	J40__CHECK_IMAGE();
+
+	if (!data) return J40__SET_INNER_ERR("Ubf0");
+	if (inner->shared) return J40__SET_INNER_ERR("Uoex"); // the TOC is already shared
+	if (inner->state != 0 || inner->has_index) return J40__SET_INNER_ERR("Ulat");
+
+	j40__init_state(&stbuf, inner);
+	err = j40__load_index(&stbuf, inner, (const uint8_t*) data, size);
+	if (err) {
+		inner->origin = ORIGIN;
+		inner->err = err;
+		return err;
+	}
+	return 0;
+}
+
 J40_API j40_err j40_output_format(j40_image *image, int32_t channel, int32_t format) {
 	static const j40__origin ORIGIN = J40__ORIGIN_output_format;
 	j40__inner *inner;
@@ -8374,6 +10717,107 @@ J40_API j40_err j40_output_format(j40_image *image, int32_t channel, int32_t for
 	return 0;
 }
 
+J40_API j40_err j40_output_rows_u8x4(j40_image *image, int32_t channel, j40_rows_u8x4_func func, void *data) {
+	static const j40__origin ORIGIN = J40__ORIGIN_output_rows;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	// TODO support more channels
+	if (channel != J40_RGBA) return J40__SET_INNER_ERR("Uch?");
+	if (!func) return J40__SET_INNER_ERR("Ufn0");
+	if (inner->frame.region_x1) return J40__SET_INNER_ERR("Uoex");
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat"); // limits may have been already checked
+
+	inner->rows_func = func;
+	inner->rows_data = data;
+	inner->streaming_limits = 1;
+	return 0;
+}
+
+J40_API int j40_next_event(j40_image *image) {
+	static const j40__origin ORIGIN = J40__ORIGIN_next_event;
+	j40__inner *inner;
+	j40_err err;
+
+	err = j40__check_image(image, ORIGIN, &inner);
+	if (err) return 0; // does NOT return err!
+
+	inner->event = 0;
+	inner->want_events = 1;
+	err = j40__advance(inner, ORIGIN);
+	inner->want_events = 0;
+	if (err) return 0;
+	return inner->event; // 0 if j40__advance has run to the end
+}
+
+J40_API j40_err j40_output_levels(j40_image *image, int32_t nlevels) {
+	static const j40__origin ORIGIN = J40__ORIGIN_output_levels;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	if (!(1 <= nlevels && nlevels <= J40_MAX_LEVELS)) return J40__SET_INNER_ERR("Ulvl");
+	if (inner->out_width && nlevels > 1) return J40__SET_INNER_ERR("Uoex");
+	if (inner->frame.region_x1 && nlevels > 1) return J40__SET_INNER_ERR("Uoex");
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat"); // LF groups may have been already read
+
+	inner->nlevels = nlevels;
+	inner->frame.keep_lf = nlevels > 3;
+	return 0;
+}
+
+J40_API j40_err j40_output_size(j40_image *image, int32_t width, int32_t height, int32_t filter) {
+	static const j40__origin ORIGIN = J40__ORIGIN_output_size;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	if (!(0 < width && width <= INT32_MAX / 4 && 0 < height)) return J40__SET_INNER_ERR("Usz?");
+	if (filter != J40_FILTER_AREA && filter != J40_FILTER_LANCZOS3) return J40__SET_INNER_ERR("Uflt");
+	if (inner->nlevels > 1) return J40__SET_INNER_ERR("Uoex");
+	if (inner->frame.region_x1) return J40__SET_INNER_ERR("Uoex");
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat"); // the frame may have been already planned
+
+	inner->out_width = width;
+	inner->out_height = height;
+	inner->out_filter = filter;
+	return 0;
+}
+
+J40_API j40_err j40_output_region(j40_image *image, int32_t x, int32_t y, int32_t width, int32_t height) {
+	static const j40__origin ORIGIN = J40__ORIGIN_output_region;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	if (!(x >= 0 && y >= 0 && 0 < width && width <= INT32_MAX / 4 - x && 0 < height && height <= INT32_MAX - y)) {
+		return J40__SET_INNER_ERR("Urgn");
+	}
+	if (inner->rows_func || inner->nlevels > 1 || inner->out_width) return J40__SET_INNER_ERR("Uoex");
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat"); // LF groups may have been already read
+
+	inner->frame.region_x0 = x;
+	inner->frame.region_y0 = y;
+	inner->frame.region_x1 = x + width;
+	inner->frame.region_y1 = y + height;
+	return 0;
+}
+
+J40_API j40_err j40_output_quality(j40_image *image, int32_t flags) {
+	static const j40__origin ORIGIN = J40__ORIGIN_output_quality;
+	j40__inner *inner;
+
+	J40__CHECK_IMAGE();
+
+	if (flags & ~(J40_APPROX_TRANSFER | J40_FIXED_POINT)) return J40__SET_INNER_ERR("Uqlt");
+	if (inner->state != inner->start_state) return J40__SET_INNER_ERR("Ulat");
+
+	inner->frame.approx_transfer = (flags & J40_APPROX_TRANSFER) != 0;
+	inner->frame.fixed_point = (flags & J40_FIXED_POINT) != 0;
+	return 0;
+}
+
 J40_API int j40_next_frame(j40_image *image) {
 	static const j40__origin ORIGIN = J40__ORIGIN_next_frame;
 	j40__inner *inner;
@@ -8389,12 +10833,23 @@ J40_API int j40_next_frame(j40_image *image) {
 	// we don't yet have multiple frames, so the second j40_next_frame call always returns 0
 	if (inner->rendered) return 0;
 
-	j40__init_state(&stbuf, inner);
-	err = j40__render_to_u8x4_rgba(&stbuf, &inner->rendered_rgba);
-	if (err) {
-		inner->origin = ORIGIN;
-		inner->err = err;
-		return 0;
+	// streaming output has been already delivered during j40__advance, nothing to render
+	if (!inner->rows_func) {
+		j40__init_state(&stbuf, inner);
+		if (inner->frame.region_x1) {
+			err = j40__render_region(&stbuf, inner);
+		} else if (inner->out_width) {
+			err = j40__render_resized(&stbuf, inner);
+		} else {
+			// VarDCT frames have been already rendered by j40__combine_vardct
+			if (!inner->rendered_rgba.type) err = j40__render_to_u8x4_rgba(&stbuf, &inner->rendered_rgba);
+			if (!err && inner->nlevels > 1) err = j40__render_levels(&stbuf, inner);
+		}
+		if (err) {
+			inner->origin = ORIGIN;
+			inner->err = err;
+			return 0;
+		}
 	}
 	inner->rendered = 1;
 	return 1;
@@ -8422,9 +10877,9 @@ J40_API j40_frame j40_current_frame(j40_image *image) {
 	return frame;
 }
 
-J40_API j40_pixels_u8x4 j40_frame_pixels_u8x4(const j40_frame *frame, int32_t channel) {
-	static const j40__origin ORIGIN = J40__ORIGIN_frame_pixels;
-
+J40_STATIC j40_pixels_u8x4 j40__frame_pixels(
+	const j40_frame *frame, int32_t channel, int32_t level, j40__origin ORIGIN
+) {
 	// on error, return this placeholder image (TODO should this include an error message?)
 	#define J40__U8X4_THIRD(a,b,c,d,e,f,g) 255,0,0,a*255, 255,0,0,b*255, 255,0,0,c*255, \
 		255,0,0,d*255, 255,0,0,e*255, 255,0,0,f*255, 255,0,0,g*255
@@ -8441,6 +10896,7 @@ J40_API j40_pixels_u8x4 j40_frame_pixels_u8x4(const j40_frame *frame, int32_t ch
 	static const j40_pixels_u8x4 ERROR_PIXELS = {21, 7, 21 * 4, ERROR_PIXELS_DATA};
 
 	j40__inner *inner;
+	const j40__plane *plane;
 	j40_pixels_u8x4 pixels;
 
 	if (!frame || frame->magic != J40__FRAME_MAGIC) return ERROR_PIXELS;
@@ -8453,14 +10909,30 @@ J40_API j40_pixels_u8x4 j40_frame_pixels_u8x4(const j40_frame *frame, int32_t ch
 	// TODO this condition is impossible under the current API
 	if (!inner->rendered) return J40__SET_INNER_ERR("Urnd"), ERROR_PIXELS;
 
-	J40__ASSERT(inner->rendered_rgba.width % 4 == 0);
-	pixels.width = inner->rendered_rgba.width / 4;
-	pixels.height = inner->rendered_rgba.height;
-	pixels.stride_bytes = inner->rendered_rgba.stride_bytes;
-	pixels.data = (void*) inner->rendered_rgba.pixels;
+	if (level == 0) {
+		plane = &inner->rendered_rgba;
+	} else {
+		if (!(0 < level && level < inner->nlevels)) return J40__SET_INNER_ERR("Ulvl"), ERROR_PIXELS;
+		plane = &inner->levels[level];
+		if (!plane->type) return J40__SET_INNER_ERR("Urnd"), ERROR_PIXELS; // frame was cut short
+	}
+
+	J40__ASSERT(plane->width % 4 == 0);
+	pixels.width = plane->width / 4;
+	pixels.height = plane->height;
+	pixels.stride_bytes = plane->stride_bytes;
+	pixels.data = (void*) plane->pixels;
 	return pixels;
 }
 
+J40_API j40_pixels_u8x4 j40_frame_pixels_u8x4(const j40_frame *frame, int32_t channel) {
+	return j40__frame_pixels(frame, channel, 0, J40__ORIGIN_frame_pixels);
+}
+
+J40_API j40_pixels_u8x4 j40_frame_level_u8x4(const j40_frame *frame, int32_t channel, int32_t level) {
+	return j40__frame_pixels(frame, channel, level, J40__ORIGIN_frame_level);
+}
+
 J40_API const j40_u8x4 *j40_row_u8x4(j40_pixels_u8x4 pixels, int32_t y) {
 	J40__ASSERT(0 <= y && y < pixels.height);
 	J40__ASSERT(pixels.stride_bytes > 0);
@@ -8468,6 +10940,68 @@ J40_API const j40_u8x4 *j40_row_u8x4(j40_pixels_u8x4 pixels, int32_t y) {
 	return (const j40_u8x4*) ((const char*) pixels.data + (size_t) pixels.stride_bytes * (size_t) y);
 }
 
+J40_STATIC j40_err j40__batch_rows(j40_pixels_u8x4 pixels, int32_t y, void *data) {
+	j40_batch_output *out = (j40_batch_output*) data;
+	size_t rowsize = (size_t) pixels.width * 4, lastrow = (size_t) (y + pixels.height - 1);
+	int32_t i;
+
+	if (!out->stride_bytes && !j40__mul32(pixels.width, 4, &out->stride_bytes)) return J40__4("bigg");
+	if ((size_t) out->stride_bytes < rowsize || out->capacity < rowsize) return J40__4("Ubsz");
+	if (lastrow > (out->capacity - rowsize) / (size_t) out->stride_bytes) return J40__4("Ubsz");
+
+	for (i = 0; i < pixels.height; ++i) {
+		memcpy((uint8_t*) out->data + (size_t) (y + i) * (size_t) out->stride_bytes,
+			j40_row_u8x4(pixels, i), rowsize);
+	}
+	out->width = pixels.width;
+	out->height = y + pixels.height;
+	return 0;
+}
+
+J40_API int32_t j40_decode_batch(
+	const j40_batch_input *inputs, j40_batch_output *outputs, int32_t n, const j40_batch_options *options
+) {
+	static const j40__origin ORIGIN = J40__ORIGIN_decode_batch;
+	j40__inner *inner = NULL;
+	j40__st stbuf, *st = &stbuf;
+	int32_t i, ndecoded = 0;
+	j40_err err = 0;
+
+	// TODO implement multiple output formats
+	if (options && options->channel != J40_RGBA) {
+		err = J40__4("Uch?");
+	} else if (options && options->format != J40_U8X4) {
+		err = J40__4("Ufm?");
+	} else {
+		// a single inner state (and its pool) is reused for all images
+		inner = (j40__inner*) j40__calloc(1, sizeof(j40__inner));
+		if (!inner) err = J40__4("!mem");
+	}
+
+	for (i = 0; i < n; ++i) {
+		j40_batch_output *out = &outputs[i];
+		out->width = out->height = 0;
+		out->err = err;
+		if (err) continue;
+		if (!inputs[i].data) {
+			out->err = J40__4("Ubf0");
+			continue;
+		}
+
+		j40__reset_inner(inner);
+		inner->rows_func = j40__batch_rows;
+		inner->rows_data = out;
+		inner->streaming_limits = 0; // whole outputs are held by the caller, so Main level 5 applies
+		j40__init_state(st, inner);
+		out->err = j40__init_memory_source(st, (uint8_t*) inputs[i].data, inputs[i].size, NULL, &inner->source);
+		if (!out->err) out->err = j40__advance(inner, ORIGIN);
+		if (!out->err) ++ndecoded;
+	}
+
+	if (inner) j40__free_inner(inner);
+	return ndecoded;
+}
+
 J40_API void j40_free(j40_image *image) {
 	j40__inner *inner;
 	j40__check_image(image, J40__ORIGIN_free, &inner);
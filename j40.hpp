@@ -0,0 +1,354 @@
+// J40: Independent, self-contained JPEG XL decoder
+// C++ companion header, Public Domain
+// https://github.com/lifthrasiir/j40
+//
+// This is a thin C++17 wrapper over the J40 public API, providing move-only owning types and
+// non-owning views to decoded pixels. It doesn't copy any pixel, and `std::span` is used for rows
+// when available (C++20); otherwise a minimal replacement with the same interface is used.
+// J40 itself should be configured and included as usual; in particular exactly one translation
+// unit should define J40_IMPLEMENTATION before including `j40.h` (or this header).
+//
+/* -------------------------------------------------------------------------------- //
+#define J40_IMPLEMENTATION // only a SINGLE file should have this
+#include "j40.hpp" // you also need to define a macro for experimental versions; follow the error.
+
+int main(int argc, char **argv) {
+    j40::image image = j40::image::from_file(argv[1]);
+    image.output_format(J40_RGBA, J40_U8X4);
+    if (image.next_frame()) {
+        j40::pixels_u8x4 pixels = image.current_frame().pixels_u8x4(J40_RGBA);
+        for (int32_t y = 0; y < pixels.height(); ++y) {
+            for (const j40_u8x4 &px : pixels.row(y)) { ... }
+        }
+    }
+    if (image.error()) return std::fprintf(stderr, "Error: %s\n", image.error_string()), 1;
+    return 0; // image is freed here
+}
+// -------------------------------------------------------------------------------- */
+
+#ifndef J40_HPP
+#define J40_HPP
+
+#ifndef __cplusplus
+#error "j40.hpp is a C++ header; use j40.h from C"
+#endif
+
+#include "j40.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#if __cplusplus >= 202002L && defined __has_include
+	#if __has_include(<span>)
+		#include <span>
+		#define J40__HPP_STD_SPAN 1
+	#endif
+#endif
+#if defined __cpp_impl_coroutine && defined __has_include
+	#if __has_include(<coroutine>)
+		#include <coroutine>
+		#include <exception>
+		#include <iterator>
+		#define J40__HPP_COROUTINE 1
+	#endif
+#endif
+
+namespace j40 {
+
+#ifdef J40__HPP_STD_SPAN
+template <typename T> using span = std::span<T>;
+#else
+// a minimal subset of std::span with a dynamic extent
+template <typename T> class span {
+public:
+	constexpr span() noexcept : ptr_(nullptr), size_(0) {}
+	constexpr span(T *ptr, std::size_t size) noexcept : ptr_(ptr), size_(size) {}
+
+	constexpr T *data() const noexcept { return ptr_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr std::size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr T &operator[](std::size_t i) const noexcept { return ptr_[i]; }
+	constexpr T *begin() const noexcept { return ptr_; }
+	constexpr T *end() const noexcept { return ptr_ + size_; }
+
+private:
+	T *ptr_;
+	std::size_t size_;
+};
+#endif
+
+// a non-owning view to RGBA8 pixels, valid until the owning `j40::image` is freed or advanced
+class pixels_u8x4 {
+public:
+	pixels_u8x4() noexcept : pixels_() {}
+	explicit pixels_u8x4(const j40_pixels_u8x4 &pixels) noexcept : pixels_(pixels) {}
+
+	int32_t width() const noexcept { return pixels_.width; }
+	int32_t height() const noexcept { return pixels_.height; }
+	int32_t stride_bytes() const noexcept { return pixels_.stride_bytes; }
+	const void *data() const noexcept { return pixels_.data; }
+	bool empty() const noexcept { return !pixels_.data; }
+
+	span<const j40_u8x4> row(int32_t y) const noexcept {
+		return span<const j40_u8x4>(j40_row_u8x4(pixels_, y), static_cast<std::size_t>(pixels_.width));
+	}
+
+	const j40_pixels_u8x4 &raw() const noexcept { return pixels_; }
+
+private:
+	j40_pixels_u8x4 pixels_;
+};
+
+// a decoded frame; only valid while the owning `j40::image` is alive
+class frame {
+public:
+	explicit frame(const j40_frame &frame) noexcept : frame_(frame) {}
+
+	frame(frame &&other) noexcept : frame_(other.frame_) {}
+	frame &operator=(frame &&other) noexcept { frame_ = other.frame_; return *this; }
+	frame(const frame &) = delete;
+	frame &operator=(const frame &) = delete;
+
+	j40::pixels_u8x4 pixels_u8x4(int32_t channel = J40_RGBA) const noexcept {
+		return j40::pixels_u8x4(j40_frame_pixels_u8x4(&frame_, channel));
+	}
+	j40::pixels_u8x4 level_u8x4(int32_t level, int32_t channel = J40_RGBA) const noexcept {
+		return j40::pixels_u8x4(j40_frame_level_u8x4(&frame_, channel, level));
+	}
+
+	const j40_frame &raw() const noexcept { return frame_; }
+
+private:
+	j40_frame frame_;
+};
+
+// an owning handle to `j40_image`. it follows the C API in that errors are sticky and
+// should be checked with `error()` at the very end. J40 itself never throws, but `mr` may.
+class image {
+public:
+	// zero-copy: `data` is borrowed and should outlive the image
+	static image from_memory(span<const uint8_t> data) noexcept {
+		image im;
+		j40_from_memory(&im.image_, const_cast<uint8_t *>(data.data()), data.size(), nullptr);
+		return im;
+	}
+
+	// `shared` should outlive the call only; the image keeps its own reference
+	static image from_shared(j40_shared *shared) noexcept {
+		image im;
+		j40_from_shared(&im.image_, shared);
+		return im;
+	}
+
+	static image from_file(const char *path) noexcept {
+		image im;
+		j40_from_file(&im.image_, path);
+		return im;
+	}
+
+	// reads the whole file to a buffer allocated from `mr`, which is released via `mr` once J40
+	// no longer needs it. any I/O error is reported by J40 itself like `from_file(path)`.
+	static image from_file(const char *path, std::pmr::memory_resource &mr) {
+		image im;
+		// closed on every path, including when `mr.allocate` throws
+		std::unique_ptr<std::FILE, decltype(&std::fclose)> fp(std::fopen(path, "rb"), &std::fclose);
+		long size = -1;
+		if (fp && std::fseek(fp.get(), 0, SEEK_END) == 0) size = std::ftell(fp.get());
+		if (size >= 0 && std::fseek(fp.get(), 0, SEEK_SET) == 0) { // ftell returns -1 on failure
+			std::size_t usize = static_cast<std::size_t>(size);
+			uint8_t *buf = allocate_owned(mr, usize);
+			if (std::fread(buf, 1, usize, fp.get()) == usize) {
+				fp.reset();
+				j40_from_memory(&im.image_, buf, usize, free_owned);
+				return im;
+			}
+			free_owned(buf);
+		}
+		fp.reset();
+		j40_from_file(&im.image_, path); // to get a consistent error
+		return im;
+	}
+
+	image(image &&other) noexcept : image_(other.image_), owned_(other.owned_) { other.owned_ = false; }
+	image &operator=(image &&other) noexcept {
+		if (this != &other) {
+			reset();
+			image_ = other.image_;
+			owned_ = other.owned_;
+			other.owned_ = false;
+		}
+		return *this;
+	}
+	image(const image &) = delete;
+	image &operator=(const image &) = delete;
+	~image() { reset(); }
+
+	j40_err error() const noexcept { return j40_error(&image_); }
+	const char *error_string() const noexcept { return j40_error_string(&image_); }
+
+	j40_err output_format(int32_t channel, int32_t format) noexcept {
+		return j40_output_format(&image_, channel, format);
+	}
+	j40_err output_levels(int32_t nlevels) noexcept { return j40_output_levels(&image_, nlevels); }
+	j40_err output_size(int32_t width, int32_t height, int32_t filter = J40_FILTER_AREA) noexcept {
+		return j40_output_size(&image_, width, height, filter);
+	}
+	j40_err output_region(int32_t x, int32_t y, int32_t width, int32_t height) noexcept {
+		return j40_output_region(&image_, x, y, width, height);
+	}
+	j40_err output_quality(int32_t flags) noexcept {
+		return j40_output_quality(&image_, flags);
+	}
+	// `cache` is not owned and should outlive the image
+	j40_err use_tile_cache(j40_tile_cache *cache, uint64_t image_id) noexcept {
+		return j40_use_tile_cache(&image_, cache, image_id);
+	}
+
+	// `func` is called as `j40_err func(j40::pixels_u8x4 rows, int32_t y)` and should outlive the decoding.
+	// see `j40_output_rows_u8x4` for details.
+	template <typename F> j40_err output_rows_u8x4(int32_t channel, F &func) noexcept {
+		return j40_output_rows_u8x4(&image_, channel, [](j40_pixels_u8x4 pixels, int32_t y, void *data) {
+			return static_cast<j40_err>((*static_cast<F *>(data))(j40::pixels_u8x4(pixels), y));
+		}, &func);
+	}
+
+	bool next_frame() noexcept { return j40_next_frame(&image_) != 0; }
+	frame current_frame() noexcept { return frame(j40_current_frame(&image_)); }
+
+	j40_image *raw() noexcept { return &image_; }
+	const j40_image *raw() const noexcept { return &image_; }
+
+private:
+	image() noexcept : image_(), owned_(true) {}
+
+	void reset() noexcept {
+		if (owned_) j40_free(&image_);
+		owned_ = false;
+	}
+
+	// owned buffers are prefixed with this header, as `j40_memory_free_func` only gets the buffer
+	struct owned_header {
+		std::pmr::memory_resource *mr;
+		std::size_t total;
+	};
+	static constexpr std::size_t OWNED_ALIGN = alignof(std::max_align_t);
+	static constexpr std::size_t OWNED_OFFSET = (sizeof(owned_header) + OWNED_ALIGN - 1) / OWNED_ALIGN * OWNED_ALIGN;
+
+	static uint8_t *allocate_owned(std::pmr::memory_resource &mr, std::size_t size) {
+		std::size_t total = OWNED_OFFSET + size;
+		void *ptr = mr.allocate(total, OWNED_ALIGN);
+		::new (ptr) owned_header{&mr, total};
+		return static_cast<uint8_t *>(ptr) + OWNED_OFFSET;
+	}
+
+	static void free_owned(void *buf) {
+		void *ptr = static_cast<uint8_t *>(buf) - OWNED_OFFSET;
+		owned_header header = *static_cast<owned_header *>(ptr);
+		header.mr->deallocate(ptr, header.total, OWNED_ALIGN);
+	}
+
+	j40_image image_;
+	bool owned_;
+};
+
+#ifdef J40__HPP_COROUTINE
+// an event from `j40::events`. `rows` is only set for J40_EVENT_ROWS and valid until the next event.
+struct event {
+	int type; // one of J40_EVENT_*
+	int32_t y; // the frame row where `rows` start
+	j40::pixels_u8x4 rows;
+};
+
+// a move-only input range of `j40::event`, where each step decodes just enough to reach the next event
+class event_generator {
+public:
+	struct promise_type {
+		const event *current = nullptr;
+
+		event_generator get_return_object() noexcept {
+			return event_generator(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		std::suspend_always final_suspend() const noexcept { return {}; }
+		std::suspend_always yield_value(const event &ev) noexcept { current = &ev; return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+
+	class iterator {
+	public:
+		using value_type = event;
+		using difference_type = std::ptrdiff_t;
+
+		iterator() noexcept : handle_() {}
+		explicit iterator(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+		const event &operator*() const noexcept { return *handle_.promise().current; }
+		const event *operator->() const noexcept { return handle_.promise().current; }
+		iterator &operator++() { handle_.resume(); return *this; }
+		void operator++(int) { handle_.resume(); }
+		bool operator==(std::default_sentinel_t) const noexcept { return !handle_ || handle_.done(); }
+
+	private:
+		std::coroutine_handle<promise_type> handle_;
+	};
+
+	event_generator(event_generator &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+	event_generator &operator=(event_generator &&other) noexcept {
+		if (this != &other) {
+			if (handle_) handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+	event_generator(const event_generator &) = delete;
+	event_generator &operator=(const event_generator &) = delete;
+	~event_generator() { if (handle_) handle_.destroy(); }
+
+	iterator begin() {
+		if (!handle_) return iterator(); // moved-from generators are empty
+		if (!handle_.done()) handle_.resume();
+		return iterator(handle_);
+	}
+	std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+	explicit event_generator(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+// decodes `im` incrementally over j40_next_event:
+//
+//   for (const j40::event &ev : j40::events(image)) {
+//       if (ev.type == J40_EVENT_ROWS) { ... ev.rows.row(0) is the frame row ev.y ... }
+//   }
+//
+// nothing is decoded until the generator is iterated, so other work (e.g. asynchronous I/O) can be
+// freely interleaved between events in a single thread. rows are streamed as in `output_rows_u8x4`,
+// so `im` shouldn't have been decoded before, and shouldn't be decoded after the generator is
+// destroyed before reaching the end, as the callback lives in the coroutine frame.
+inline event_generator events(image &im) {
+	event ev{0, 0, j40::pixels_u8x4()};
+	auto on_rows = [&ev](j40::pixels_u8x4 rows, int32_t y) -> j40_err {
+		ev.rows = rows;
+		ev.y = y;
+		return 0;
+	};
+	if (im.output_rows_u8x4(J40_RGBA, on_rows)) co_return;
+	while ((ev.type = j40_next_event(im.raw())) != 0) {
+		co_yield ev;
+		ev.y = 0;
+		ev.rows = j40::pixels_u8x4();
+	}
+}
+#endif // defined J40__HPP_COROUTINE
+
+} // namespace j40
+
+#endif // !defined J40_HPP